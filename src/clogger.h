@@ -36,6 +36,26 @@ extern "C" {
 
 #define LOGGER_MAX_LEVEL    7
 
+// number of digits shown after the seconds in a message's time
+#define CLOGGER_TIME_SECONDS        0
+#define CLOGGER_TIME_MILLISECONDS   3
+#define CLOGGER_TIME_MICROSECONDS   6
+#define CLOGGER_TIME_NANOSECONDS    9
+
+/*
+ * What happens to a message logged while the buffer is full; see
+ * logger_set_overflow_policy().
+ */
+#define CLOGGER_OVERFLOW_DROP_NEWEST        0
+#define CLOGGER_OVERFLOW_BLOCK              1
+#define CLOGGER_OVERFLOW_OVERWRITE_OLDEST   2
+#define CLOGGER_OVERFLOW_DROP_BELOW_LEVEL   3
+
+/*
+ * Messages up to this length are formatted on the stack of the calling thread
+ * and copied to the buffer. Longer messages are still logged, but they're
+ * formatted a second time directly into the buffer.
+ */
 #ifndef CLOGGER_MAX_MESSAGE_SIZE
 #define CLOGGER_MAX_MESSAGE_SIZE 200
 #endif
@@ -48,6 +68,19 @@ extern "C" {
 #define CLOGGER_MAX_NUM_HANDLERS 5
 #endif
 
+/*
+ * When thread buffers are enabled (see logger_options), this many threads can
+ * have one at a time. Threads beyond that share the logger's buffer.
+ */
+#ifndef CLOGGER_MAX_NUM_THREAD_BUFFERS
+#define CLOGGER_MAX_NUM_THREAD_BUFFERS 64
+#endif
+
+/*
+ * By default the buffer is sized to hold this many messages of
+ * CLOGGER_MAX_MESSAGE_SIZE; messages only use the space they need, so it holds
+ * more shorter messages. logger_init_with_options() can choose another size.
+ */
 #ifndef CLOGGER_BUFFER_SIZE
 #define CLOGGER_BUFFER_SIZE 50
 #endif
@@ -58,6 +91,15 @@ extern "C" {
  * going to make sure.
  */
 
+/*
+ * Messages logged with the CLOG_* macros below that are more verbose than this
+ * level are removed at compile time, including their arguments. Defining
+ * this as -1 removes all of them.
+ */
+#ifndef CLOGGER_ACTIVE_LEVEL
+#define CLOGGER_ACTIVE_LEVEL LOGGER_MAX_LEVEL
+#endif
+
 #if CLOGGER_MAX_MESSAGE_SIZE < 10
 #error "Logger max message size must be 10 or greater"
 #endif
@@ -70,11 +112,80 @@ extern "C" {
 #error "There must be at least one handler"
 #endif
 
+#if CLOGGER_MAX_NUM_HANDLERS > 32
+#error "There can't be more than 32 handlers"
+#endif
+
 
 // ################ HANDLER CODE ################
+
+/*
+ * Controls when a file handler writes the lines it's holding to the file.
+ * The lines are written as soon as any of the conditions is met, and always
+ * when the logger is freed.
+ */
+typedef struct {
+    size_t  max_bytes;      // this many bytes are waiting; 0 writes every batch right away
+    int     interval_ms;    // the oldest line has waited this long; 0 to disable
+    int     flush_level;    // a message at or below this level was logged; -1 to disable
+} logger_flush_policy;
+
+/*
+ * When enabled, each handler created afterwards gets its own thread and
+ * buffer, so a slow handler only delays (or, once its buffer is full, drops)
+ * its own messages instead of holding up every handler. Disabled by default.
+ */
+int logger_set_handler_threads(int p_bEnabled);
+
 int logger_create_console_handler(FILE *p_pOut);
+
+/*
+ * Lines are written to the file as soon as the logger thread receives them.
+ */
 int logger_create_file_handler(char* p_sLogLocation, char* p_sLogName);
 
+/*
+ * Lines are held in memory and written to the file according to p_pPolicy.
+ */
+int logger_create_file_handler_with_policy(char* p_sLogLocation, char* p_sLogName, const logger_flush_policy* p_pPolicy);
+
+/*
+ * How the console and file handlers write each message. CLOGGER_FORMAT_TEXT
+ * (the default) writes the date, level, ID and message on a line.
+ * CLOGGER_FORMAT_JSON writes one JSON object per line, with the fields "time"
+ * (seconds since the epoch), "level", "id", "msg" and "thread", plus "file",
+ * "line" and "func" for messages logged with the CLOG_* macros.
+ */
+#define CLOGGER_FORMAT_TEXT 0
+#define CLOGGER_FORMAT_JSON 1
+
+/*
+ * Changes how the handler numbered p_nHandler (see CLOGGER_HANDLER()) writes
+ * messages. The Graylog handler always sends GELF.
+ *
+ * Returns 0 on success
+ */
+int logger_set_handler_format(int p_nHandler, int p_nFormat);
+
+/*
+ * Changes what each line the handler numbered p_nHandler writes with
+ * CLOGGER_FORMAT_TEXT looks like. The pattern is copied as is, except for:
+ *
+ *  %t  the date
+ *  %L  the level, padded so every level is the same length
+ *  %i  the ID
+ *  %m  the message
+ *  %T  the ID of the thread that logged the message
+ *  %s  the file and line the message was logged from (file:line)
+ *  %F  the function the message was logged from
+ *  %%  a %
+ *
+ * The default is "%t %L %i %m". The Graylog handler doesn't use layouts.
+ *
+ * Returns 0 on success
+ */
+int logger_set_handler_layout(int p_nHandler, const char* p_sPattern);
+
 #ifdef CLOGGER_GRAYLOG
 #define GRAYLOG_TCP 0
 #define GRAYLOG_UDP 1
@@ -87,6 +198,38 @@ typedef int logger_id;
 extern const logger_id CLOGGER_DEFAULT_ID;
 logger_id logger_create_id(char* p_sID);
 int logger_remove_id(logger_id id_ref);
+/*
+ * Returns an existing ID created with the given text, or -1 if there
+ * isn't one.
+ */
+logger_id logger_find_id(char* p_sID);
+
+/*
+ * Handlers are numbered from 0 in the order they're created. Each ID has a
+ * mask of the handlers its messages are written to; new IDs write to all of
+ * them.
+ */
+#define CLOGGER_HANDLER(n)      (1u << (n))
+#define CLOGGER_ALL_HANDLERS    (~0u)
+
+/*
+ * Logs messages with this ID up to p_nLogLevel instead of the logger's level,
+ * e.g. LOGGER_DEBUG for one noisy part of a program. Pass -1 to follow the
+ * logger's level again.
+ *
+ * Returns 0 on success
+ */
+int logger_set_id_level(logger_id id_ref, int p_nLogLevel);
+
+/*
+ * Writes messages with this ID only to the handlers in p_nHandlers, e.g.
+ * CLOGGER_HANDLER(1). A mask of 0 stops the ID from being logged. Messages
+ * for handlers that don't exist aren't formatted; they're counted in
+ * logger_stats.unrouted.
+ *
+ * Returns 0 on success
+ */
+int logger_set_id_handlers(logger_id id_ref, unsigned int p_nHandlers);
 
 
 
@@ -100,6 +243,37 @@ int logger_remove_id(logger_id id_ref);
  */
 int logger_init(int p_nLogLevel);
 
+/*
+ * Settings for logger_init_with_options(). Leave any of the sizes 0 to use
+ * the defaults the library was built with.
+ */
+typedef struct {
+    int     log_level;
+    size_t  buffer_bytes;   // space for messages on the buffer; rounded up to a power of two
+    size_t  reserve_bytes;  // messages are no longer added when only this much space is left
+    int     shed_percent;   // how full the buffer gets before CLOGGER_OVERFLOW_DROP_BELOW_LEVEL drops messages
+    size_t  thread_buffer_bytes;    // gives each thread that logs its own buffer of this size; 0 to share one buffer
+} logger_options;
+
+/*!
+ * Same as logger_init(), but lets the size of the buffer be chosen when the
+ * program runs. Handlers with their own thread get buffers of the same size.
+ *
+ * With thread buffers, each thread gets its own buffer the first time it logs
+ * a message, so threads never compete for space; the logger thread writes
+ * the messages from all of them in timestamp order. A thread's buffer is
+ * removed after the thread exits.
+ *
+ * Each buffer must have room for two messages of CLOGGER_MAX_MESSAGE_SIZE
+ * above reserve_bytes, since a message may need padding where the buffer
+ * wraps around. A message that takes more than half of that space is never
+ * added.
+ *
+ * Returns 0 on success
+ *
+ */
+int logger_init_with_options(const logger_options* p_pOptions);
+
 /*!
  * Tells the logger thread it's time to exit, then frees any
  * used memory.
@@ -125,6 +299,16 @@ int logger_log_msg(int p_nLogLevel, char* msg, ...);
  */
 int logger_log_msg_id(int p_nLogLevel, logger_id log_id, char* msg, ...);
 
+/*!
+ * Same as logger_log_msg_id(), but also records where the message was logged.
+ * p_sFile and p_sFunc aren't copied, so they must stay valid until the message
+ * is written; the CLOG_* macros pass __FILE__ and __func__.
+ *
+ * Returns 0 on success
+ *
+ */
+int logger_log_msg_at(int p_nLogLevel, logger_id log_id, const char* p_sFile, int p_nLine, const char* p_sFunc, char* msg, ...);
+
 /*!
  * Returns the integer representation of the log level specified
  * by the string p_sLogLevel.
@@ -142,6 +326,224 @@ int logger_log_str_to_int(char* p_sLogLevel);
  */
 int logger_is_running();
 
+/*!
+ * Returns an int indicating if a message with log level p_nLogLevel would
+ * be logged.
+ *
+ * Returns > 0 if it would be logged, 0 if it wouldn't
+ *
+ */
+int logger_level_enabled(int p_nLogLevel);
+
+/*!
+ * Changes the most verbose level that's logged while the logger is running;
+ * it takes effect for every thread right away.
+ *
+ * Returns 0 on success
+ *
+ */
+int logger_set_level(int p_nLogLevel);
+
+/*!
+ * Returns the most verbose level that's logged, or -1 if the logger isn't
+ * running.
+ *
+ */
+int logger_get_level();
+
+/*
+ * The current log level, for CLOGGER_LEVEL_ENABLED(). Only read it with
+ * __atomic_load_n(); use logger_set_level() to change it.
+ */
+extern int g_nCloggerLogLevel;
+
+/*
+ * Checks a level against the logger's without a function call. Nothing is
+ * enabled while the logger isn't running.
+ */
+#define CLOGGER_LEVEL_ENABLED(level) \
+    ((level) <= __atomic_load_n(&g_nCloggerLogLevel, __ATOMIC_RELAXED))
+
+/*
+ * The most verbose level logged with CLOGGER_DEFAULT_ID, for
+ * CLOGGER_DEFAULT_ID_ENABLED(). It follows the logger's level unless the ID
+ * was given its own level, and is -1 when the ID has no handlers. Only read
+ * it with __atomic_load_n().
+ */
+extern int g_nCloggerDefaultIdLevel;
+
+/*
+ * Same as logger_id_level_enabled(CLOGGER_DEFAULT_ID, level) without a
+ * function call.
+ */
+#define CLOGGER_DEFAULT_ID_ENABLED(level) \
+    ((level) <= __atomic_load_n(&g_nCloggerDefaultIdLevel, __ATOMIC_RELAXED))
+
+/*!
+ * Returns an int indicating if a message with log level p_nLogLevel would
+ * be logged with the ID id_ref.
+ *
+ * Returns > 0 if it would be logged, 0 if it wouldn't
+ *
+ */
+int logger_id_level_enabled(logger_id id_ref, int p_nLogLevel);
+
+/*!
+ * Sets the number of fractional second digits, from 0 to 9, shown in the
+ * time of each message. See CLOGGER_TIME_SECONDS and related values.
+ *
+ * Returns 0 on success
+ *
+ */
+int logger_set_time_precision(int p_nDigits);
+
+/*!
+ * Enables or disables deferred formatting.
+ *
+ * When enabled, the calling thread only copies the arguments of a message
+ * (strings are copied by value) and the logger thread formats it. The format
+ * string itself is NOT copied, so it must remain valid until the message is
+ * written; only enable this if every format passed to the logger is a string
+ * literal. Messages whose arguments don't fit in CLOGGER_MAX_MESSAGE_SIZE,
+ * and formats that can't be deferred (%n, %m, positional arguments), are
+ * formatted by the calling thread instead; nothing is truncated.
+ *
+ * Returns 0 on success
+ *
+ */
+int logger_set_deferred_format(int p_bEnabled);
+
+/*!
+ * Chooses what happens when a message is logged while the buffer is full:
+ *
+ * CLOGGER_OVERFLOW_DROP_NEWEST (default): the new message isn't logged;
+ *     p_nValue is ignored.
+ * CLOGGER_OVERFLOW_BLOCK: the calling thread waits up to p_nValue
+ *     milliseconds for space before giving up on the message.
+ * CLOGGER_OVERFLOW_OVERWRITE_OLDEST: the oldest messages the logger thread
+ *     hasn't started writing are removed to make room; p_nValue is ignored.
+ * CLOGGER_OVERFLOW_DROP_BELOW_LEVEL: once the buffer is half full (see
+ *     logger_options), messages more verbose than level p_nValue aren't
+ *     logged, leaving the rest of the space for the more important ones.
+ *
+ * The logging functions return non-zero for every message that isn't logged.
+ *
+ * Returns 0 on success
+ *
+ */
+int logger_set_overflow_policy(int p_nPolicy, int p_nValue);
+
+typedef struct {
+    unsigned long dropped;          // not logged because the buffer was full
+    unsigned long overwritten;      // removed by CLOGGER_OVERFLOW_OVERWRITE_OLDEST before being written
+    unsigned long shed;             // not logged by CLOGGER_OVERFLOW_DROP_BELOW_LEVEL
+    unsigned long timed_out;        // not logged because CLOGGER_OVERFLOW_BLOCK ran out of time
+    unsigned long handler_dropped;  // lost by handlers, or handler threads, that couldn't keep up or open
+    unsigned long unrouted;         // not written because none of the handlers their ID writes to exist
+} logger_stats;
+
+/*!
+ * Fills p_pStats with the number of messages lost since the program started.
+ *
+ * Returns 0 on success
+ *
+ */
+int logger_get_stats(logger_stats* p_pStats);
+
+
+// ################ Logging Macros ################
+
+/*
+ * The macros below check the log level before any of their arguments are
+ * evaluated, so expensive arguments cost nothing when the level is disabled.
+ * Levels above CLOGGER_ACTIVE_LEVEL compile to nothing at all. The file,
+ * line and function each message is logged from are recorded with it. An
+ * ID passed to the _ID macros is evaluated once.
+ *
+ *  CLOG_INFO("Processed %d items", count);
+ *  CLOG_INFO_ID(my_id, "Processed %d items", count);
+ */
+#define CLOG_LOG(level, ...) \
+    do { \
+        if (((level) <= CLOGGER_ACTIVE_LEVEL) && CLOGGER_DEFAULT_ID_ENABLED(level)) { \
+            logger_log_msg_at((level), CLOGGER_DEFAULT_ID, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define CLOG_LOG_ID(level, id, ...) \
+    do { \
+        logger_id clog_id_ = (id); \
+        if (((level) <= CLOGGER_ACTIVE_LEVEL) && logger_id_level_enabled(clog_id_, (level))) { \
+            logger_log_msg_at((level), clog_id_, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define CLOG_DISABLED() do { } while (0)
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_EMERGENCY
+#define CLOG_EMERGENCY(...)         CLOG_LOG(LOGGER_EMERGENCY, __VA_ARGS__)
+#define CLOG_EMERGENCY_ID(id, ...)  CLOG_LOG_ID(LOGGER_EMERGENCY, id, __VA_ARGS__)
+#else
+#define CLOG_EMERGENCY(...)         CLOG_DISABLED()
+#define CLOG_EMERGENCY_ID(id, ...)  CLOG_DISABLED()
+#endif
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_ALERT
+#define CLOG_ALERT(...)             CLOG_LOG(LOGGER_ALERT, __VA_ARGS__)
+#define CLOG_ALERT_ID(id, ...)      CLOG_LOG_ID(LOGGER_ALERT, id, __VA_ARGS__)
+#else
+#define CLOG_ALERT(...)             CLOG_DISABLED()
+#define CLOG_ALERT_ID(id, ...)      CLOG_DISABLED()
+#endif
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_CRITICAL
+#define CLOG_CRITICAL(...)          CLOG_LOG(LOGGER_CRITICAL, __VA_ARGS__)
+#define CLOG_CRITICAL_ID(id, ...)   CLOG_LOG_ID(LOGGER_CRITICAL, id, __VA_ARGS__)
+#else
+#define CLOG_CRITICAL(...)          CLOG_DISABLED()
+#define CLOG_CRITICAL_ID(id, ...)   CLOG_DISABLED()
+#endif
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_ERROR
+#define CLOG_ERROR(...)             CLOG_LOG(LOGGER_ERROR, __VA_ARGS__)
+#define CLOG_ERROR_ID(id, ...)      CLOG_LOG_ID(LOGGER_ERROR, id, __VA_ARGS__)
+#else
+#define CLOG_ERROR(...)             CLOG_DISABLED()
+#define CLOG_ERROR_ID(id, ...)      CLOG_DISABLED()
+#endif
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_WARN
+#define CLOG_WARN(...)              CLOG_LOG(LOGGER_WARN, __VA_ARGS__)
+#define CLOG_WARN_ID(id, ...)       CLOG_LOG_ID(LOGGER_WARN, id, __VA_ARGS__)
+#else
+#define CLOG_WARN(...)              CLOG_DISABLED()
+#define CLOG_WARN_ID(id, ...)       CLOG_DISABLED()
+#endif
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_NOTICE
+#define CLOG_NOTICE(...)            CLOG_LOG(LOGGER_NOTICE, __VA_ARGS__)
+#define CLOG_NOTICE_ID(id, ...)     CLOG_LOG_ID(LOGGER_NOTICE, id, __VA_ARGS__)
+#else
+#define CLOG_NOTICE(...)            CLOG_DISABLED()
+#define CLOG_NOTICE_ID(id, ...)     CLOG_DISABLED()
+#endif
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_INFO
+#define CLOG_INFO(...)              CLOG_LOG(LOGGER_INFO, __VA_ARGS__)
+#define CLOG_INFO_ID(id, ...)       CLOG_LOG_ID(LOGGER_INFO, id, __VA_ARGS__)
+#else
+#define CLOG_INFO(...)              CLOG_DISABLED()
+#define CLOG_INFO_ID(id, ...)       CLOG_DISABLED()
+#endif
+
+#if CLOGGER_ACTIVE_LEVEL >= LOGGER_DEBUG
+#define CLOG_DEBUG(...)             CLOG_LOG(LOGGER_DEBUG, __VA_ARGS__)
+#define CLOG_DEBUG_ID(id, ...)      CLOG_LOG_ID(LOGGER_DEBUG, id, __VA_ARGS__)
+#else
+#define CLOG_DEBUG(...)             CLOG_DISABLED()
+#define CLOG_DEBUG_ID(id, ...)      CLOG_DISABLED()
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,163 @@
+#include "logger_json.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// the longest string checked
+#define JSON_TEST_MAX_LEN 300
+
+// random strings checked against the reference
+#define JSON_TEST_RANDOM_STRINGS 200000
+
+static const char* g_sImplNames[] = { "scalar", "SSE2", "AVX2" };
+static bool g_bImplUsed[] = { false, false, false };
+
+// a seeded generator, so every run checks the same strings
+static uint64_t g_nRandState = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t json_test_rand() {
+    g_nRandState ^= g_nRandState << 13;
+    g_nRandState ^= g_nRandState >> 7;
+    g_nRandState ^= g_nRandState << 17;
+    return (uint32_t) (g_nRandState >> 32);
+}
+
+// escapes one character at a time, the way RFC 8259 describes
+static char* json_test_reference(char* p_pDest, const char* p_sSrc, size_t p_nLen) {
+    for (size_t count = 0; count < p_nLen; count++) {
+        unsigned char t_cChar = (unsigned char) p_sSrc[count];
+        switch (t_cChar) {
+            case '"':  p_pDest += sprintf(p_pDest, "\\\""); break;
+            case '\\': p_pDest += sprintf(p_pDest, "\\\\"); break;
+            case '\b': p_pDest += sprintf(p_pDest, "\\b"); break;
+            case '\f': p_pDest += sprintf(p_pDest, "\\f"); break;
+            case '\n': p_pDest += sprintf(p_pDest, "\\n"); break;
+            case '\r': p_pDest += sprintf(p_pDest, "\\r"); break;
+            case '\t': p_pDest += sprintf(p_pDest, "\\t"); break;
+            default:
+                if (t_cChar < 0x20)
+                    p_pDest += sprintf(p_pDest, "\\u%04x", t_cChar);
+                else
+                    *p_pDest++ = (char) t_cChar;
+        }
+    }
+    return p_pDest;
+}
+
+/*
+ * Escapes p_sSrc with lgj_escape() and with each implementation this CPU can
+ * run, and compares them all to the reference.
+ */
+static bool json_test_check(const char* p_sSrc, size_t p_nLen) {
+
+    // the vector versions store whole blocks past what they keep
+    static char t_sExpected[LGJ_ESCAPED_MAX_LEN(JSON_TEST_MAX_LEN) + 64];
+    static char t_sGot[LGJ_ESCAPED_MAX_LEN(JSON_TEST_MAX_LEN) + 64];
+
+    size_t t_nExpectedLen = (size_t) (json_test_reference(t_sExpected, p_sSrc, p_nLen) - t_sExpected);
+
+    for (int t_nImpl = -1; t_nImpl <= LGJ_ESCAPE_AVX2; t_nImpl++) {
+        char* t_pEnd;
+        if (t_nImpl < 0)
+            t_pEnd = lgj_escape(t_sGot, p_sSrc, p_nLen);
+        else
+            t_pEnd = lgj_escape_using(t_nImpl, t_sGot, p_sSrc, p_nLen);
+        if (t_pEnd == NULL)
+            continue;   // not available here
+        else if (t_nImpl >= 0)
+            g_bImplUsed[t_nImpl] = true;
+
+        size_t t_nGotLen = (size_t) (t_pEnd - t_sGot);
+        if ((t_nGotLen != t_nExpectedLen) || memcmp(t_sGot, t_sExpected, t_nGotLen)) {
+            fprintf(stderr, "%s escaped a %zu character string wrong:\n", (t_nImpl < 0 ? "lgj_escape()" : g_sImplNames[t_nImpl]), p_nLen);
+            fprintf(stderr, "  expected: %.*s\n", (int) t_nExpectedLen, t_sExpected);
+            fprintf(stderr, "  got:      %.*s\n", (int) t_nGotLen, t_sGot);
+            return false;
+        }
+    }
+    return true;
+}
+
+// every character on its own, and in the middle of a full block of each size
+static bool json_test_single_chars() {
+    char t_sSrc[JSON_TEST_MAX_LEN];
+    for (int t_nChar = 0; t_nChar < 256; t_nChar++) {
+        t_sSrc[0] = (char) t_nChar;
+        if (!json_test_check(t_sSrc, 1))
+            return false;
+
+        memset(t_sSrc, 'a', 64);
+        t_sSrc[17] = (char) t_nChar;
+        t_sSrc[40] = (char) t_nChar;
+        if (!json_test_check(t_sSrc, 64))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Puts characters that need escaping, and the ones next to them in value
+ * (0x1f, 0x20, 0x7f, 0x80), at every position of strings of every length
+ * around the 16 and 32 character blocks, so each block's tail is checked.
+ */
+static bool json_test_block_tails() {
+    static const char t_sEdges[] = { '"', '\\', '\n', 0x00, 0x1f, 0x20, 0x7f, (char) 0x80, (char) 0xff };
+    char t_sSrc[JSON_TEST_MAX_LEN];
+    for (size_t t_nLen = 0; t_nLen <= 100; t_nLen++) {
+        for (size_t t_nEdge = 0; t_nEdge < sizeof(t_sEdges); t_nEdge++) {
+            for (size_t t_nPos = 0; t_nPos < t_nLen; t_nPos++) {
+                memset(t_sSrc, 'x', t_nLen);
+                t_sSrc[t_nPos] = t_sEdges[t_nEdge];
+                if (!json_test_check(t_sSrc, t_nLen))
+                    return false;
+            }
+
+            // one at the end of every block
+            memset(t_sSrc, 'x', t_nLen);
+            for (size_t t_nPos = 15; t_nPos < t_nLen; t_nPos += 16)
+                t_sSrc[t_nPos] = t_sEdges[t_nEdge];
+            if (!json_test_check(t_sSrc, t_nLen))
+                return false;
+        }
+    }
+    return true;
+}
+
+// strings of random length, from clean text to nothing but random bytes
+static bool json_test_random() {
+    static const char t_sSpecial[] = { '"', '\\', '\n', '\t', 0x01, 0x1f, 0x7f, (char) 0x80 };
+    char t_sSrc[JSON_TEST_MAX_LEN];
+    for (int count = 0; count < JSON_TEST_RANDOM_STRINGS; count++) {
+        size_t t_nLen = json_test_rand() % JSON_TEST_MAX_LEN;
+        uint32_t t_nDensity = json_test_rand() % 4;
+        for (size_t t_nPos = 0; t_nPos < t_nLen; t_nPos++) {
+            if (t_nDensity == 0)
+                t_sSrc[t_nPos] = (char) json_test_rand();
+            else if ((json_test_rand() % (t_nDensity * 20)) == 0)
+                t_sSrc[t_nPos] = t_sSpecial[json_test_rand() % sizeof(t_sSpecial)];
+            else
+                t_sSrc[t_nPos] = (char) ('a' + (json_test_rand() % 26));
+        }
+        if (!json_test_check(t_sSrc, t_nLen))
+            return false;
+    }
+    return true;
+}
+
+int main() {
+
+    if (!json_test_single_chars() || !json_test_block_tails() || !json_test_random()) {
+        printf("The JSON escape test failed\n");
+        return 1;
+    }
+
+    printf("Checked lgj_escape() and:");
+    for (int t_nImpl = 0; t_nImpl <= LGJ_ESCAPE_AVX2; t_nImpl++) {
+        if (g_bImplUsed[t_nImpl])
+            printf(" %s", g_sImplNames[t_nImpl]);
+    }
+    printf("\nThe JSON escape test worked\n");
+    return 0;
+}
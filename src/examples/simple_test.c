@@ -40,6 +40,9 @@ int main(__attribute__((unused))int argc, __attribute__((unused))char** argv) {
         fprintf(stderr, "Failed to add second message to logger.\n");
     }
 
+    // the macros only evaluate their arguments if the level is enabled
+    CLOG_DEBUG_ID(log_id, "Logging a message with a macro; id %d", log_id);
+
     // stop the log thread, close open handlers, and free memory when done
     if (logger_free()) {
         fprintf(stderr, "Failed to stop the logger.\n");
@@ -1,39 +1,136 @@
 
 #include "console_handler.h"
+#include "../logger_formatter.h"
+#include "../logger_json.h"
 
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h> //memcpy()
 
-// GLOBAL VARS
-static FILE* g_pOut = { NULL };
-// END GLOBAL VARS
+// space used to put a batch of messages together before writing them
+#define CONSOLE_BATCH_BUF_SIZE 16384
+
+// data for each console handler
+typedef struct {
+    FILE*       m_pOut;
+    atomic_int  m_nFormat;
+    _Atomic(lgf_layout*) m_pLayout;
+    char        m_sBatchBuf[CONSOLE_BATCH_BUF_SIZE];
+} console_handler_ctx;
 
 // PRIVATE FUNCTION DECLARATIONS
-static int _console_handler_close();
-static int _console_handler_write(const t_loggermsg* p_sMsg);
+static int _console_handler_close(void* p_pContext);
+static int _console_handler_write(void* p_pContext, const t_loggermsg* p_sMsg);
+static int _console_handler_write_batch(void* p_pContext, const t_loggermsg** p_pMsgs, int p_nCount);
+static int _console_handler_set_format(void* p_pContext, int p_nFormat);
+static int _console_handler_set_layout(void* p_pContext, const char* p_sPattern);
+static int _console_handler_write_alone(console_handler_ctx* p_pCtx, const lgf_layout* p_pLayout, const t_loggermsg* p_sMsg);
+static void _console_handler_free(void* p_pContext);
 // END PRIVATE FUNCTION DECLARATIONS
 
 // PRIVATE FUNCTION DEFINITIONS
-int _console_handler_close() {
+int _console_handler_close(__attribute__((unused))void* p_pContext) {
     // nothing to do for the console
     return 0;
 }
 
-int _console_handler_write(const t_loggermsg* p_sMsg) {
-    // TODO check a status or anything?
-    fprintf(g_pOut, "%s%s %s\n", p_sMsg->m_sFormat, p_sMsg->m_sId, p_sMsg->m_sMsg);
+int _console_handler_write(void* p_pContext, const t_loggermsg* p_sMsg) {
+    return _console_handler_write_batch(p_pContext, &p_sMsg, 1);
+}
+
+/*
+ * Writes a line that's too long for the batch buffer by itself. p_pLayout is
+ * NULL when the line is written as JSON.
+ */
+int _console_handler_write_alone(console_handler_ctx* p_pCtx, const lgf_layout* p_pLayout, const t_loggermsg* p_sMsg) {
+    size_t t_nLineLen = (p_pLayout == NULL ? lgj_line_max_len(p_sMsg) : lgf_layout_len(p_pLayout, p_sMsg));
+    char* t_sLine = (char*) malloc(t_nLineLen);
+    if (t_sLine == NULL) {
+        fprintf(stderr, "console_handler: Failed to allocate space for a line.\n");
+        return 1;
+    }
+    char* t_pEnd;
+    if (p_pLayout == NULL)
+        t_pEnd = lgj_format_line(t_sLine, p_sMsg);
+    else
+        t_pEnd = lgf_render_layout(p_pLayout, t_sLine, p_sMsg);
+    fwrite(t_sLine, 1, (size_t) (t_pEnd - t_sLine), p_pCtx->m_pOut);
+    free(t_sLine);
     return 0;
 }
 
-int _console_handler_open() {
+/*
+ * Copies as many lines as fit into the batch buffer and writes them with one
+ * fwrite(). A line that's too long for the buffer is written by itself.
+ */
+int _console_handler_write_batch(void* p_pContext, const t_loggermsg** p_pMsgs, int p_nCount) {
+
+    console_handler_ctx* t_pCtx = (console_handler_ctx*) p_pContext;
+    // NULL when the lines are written as JSON
+    const lgf_layout* t_pLayout = NULL;
+    if (atomic_load_explicit(&t_pCtx->m_nFormat, memory_order_relaxed) != CLOGGER_FORMAT_JSON)
+        t_pLayout = atomic_load_explicit(&t_pCtx->m_pLayout, memory_order_acquire);
+
+    int t_nRtn = 0;
+    size_t t_nUsed = 0;
+    for (int count = 0; count < p_nCount; count++) {
+        const t_loggermsg* t_pMsg = p_pMsgs[count];
+        // for JSON this is only an upper bound; the line is usually shorter
+        size_t t_nLineLen = (t_pLayout == NULL ? lgj_line_max_len(t_pMsg) : lgf_layout_len(t_pLayout, t_pMsg));
+
+        if ((t_nUsed + t_nLineLen) > CONSOLE_BATCH_BUF_SIZE) {
+            fwrite(t_pCtx->m_sBatchBuf, 1, t_nUsed, t_pCtx->m_pOut);
+            t_nUsed = 0;
+            if (t_nLineLen > CONSOLE_BATCH_BUF_SIZE) {
+                if (_console_handler_write_alone(t_pCtx, t_pLayout, t_pMsg))
+                    t_nRtn = 1;
+                continue;
+            }
+        }
+
+        char* t_pEnd;
+        if (t_pLayout == NULL)
+            t_pEnd = lgj_format_line(t_pCtx->m_sBatchBuf + t_nUsed, t_pMsg);
+        else
+            t_pEnd = lgf_render_layout(t_pLayout, t_pCtx->m_sBatchBuf + t_nUsed, t_pMsg);
+        t_nUsed = (size_t) (t_pEnd - t_pCtx->m_sBatchBuf);
+    }
+
+    if (t_nUsed > 0)
+        fwrite(t_pCtx->m_sBatchBuf, 1, t_nUsed, t_pCtx->m_pOut);
+
+    return t_nRtn;
+}
+
+int _console_handler_set_format(void* p_pContext, int p_nFormat) {
+    console_handler_ctx* t_pCtx = (console_handler_ctx*) p_pContext;
+    if ((p_nFormat != CLOGGER_FORMAT_TEXT) && (p_nFormat != CLOGGER_FORMAT_JSON))
+        return 1;
+    atomic_store_explicit(&t_pCtx->m_nFormat, p_nFormat, memory_order_relaxed);
+    return 0;
+}
+
+int _console_handler_set_layout(void* p_pContext, const char* p_sPattern) {
+    console_handler_ctx* t_pCtx = (console_handler_ctx*) p_pContext;
+    return lgf_replace_layout(&t_pCtx->m_pLayout, p_sPattern);
+}
+
+int _console_handler_open(__attribute__((unused))void* p_pContext) {
     // TODO should we do some checks here?
     return 0;
 }
 
-int _console_handler_isOpen() {
+int _console_handler_isOpen(__attribute__((unused))void* p_pContext) {
     // TODO should we do some checks here?
     // return 1 so function passes if() checks
     return 1;
 }
+
+void _console_handler_free(void* p_pContext) {
+    console_handler_ctx* t_pCtx = (console_handler_ctx*) p_pContext;
+    lgf_free_layout(atomic_load(&t_pCtx->m_pLayout));
+    free(t_pCtx);
+}
 // END PRIVATE FUNCTION DEFINITIONS
 
 // PUBLIC FUNCTION DEFINITIONS
@@ -52,7 +149,18 @@ int create_console_handler(log_handler *p_pHandler, FILE *p_pOut) {
         return 1;
     }
 
-    g_pOut = p_pOut;
+    console_handler_ctx* t_pCtx = (console_handler_ctx*) malloc(sizeof(console_handler_ctx));
+    if (t_pCtx == NULL) {
+        fprintf(stderr, "console_handler: Failed to allocate space for the handler.\n");
+        return 1;
+    }
+    t_pCtx->m_pOut = p_pOut;
+    atomic_init(&t_pCtx->m_nFormat, CLOGGER_FORMAT_TEXT);
+    atomic_init(&t_pCtx->m_pLayout, NULL);
+    if (lgf_replace_layout(&t_pCtx->m_pLayout, FORMATTER_DEFAULT_LAYOUT)) {
+        free(t_pCtx);
+        return 1;
+    }
 
     log_handler t_structHandler = {
         &_console_handler_write,
@@ -60,7 +168,13 @@ int create_console_handler(log_handler *p_pHandler, FILE *p_pOut) {
         &_console_handler_open,
         &_console_handler_isOpen,
         true,
-        true
+        true,
+        &_console_handler_write_batch,
+        NULL,
+        &_console_handler_set_format,
+        &_console_handler_set_layout,
+        &_console_handler_free,
+        t_pCtx
     };
 
     memcpy(p_pHandler, &t_structHandler, sizeof(log_handler));
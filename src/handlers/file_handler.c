@@ -1,76 +1,298 @@
 
 #include "file_handler.h"
 
+#include "../logger_formatter.h"
+#include "../logger_json.h"
 #include "../logger_util.h"
 
+#include <errno.h>
+#include <fcntl.h>  // open()
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h> // memcpy()
 #include <sys/stat.h>   // mkdir()
+#include <sys/uio.h>    // writev()
+#include <time.h>
+#include <unistd.h> // write(), close()
 
 #define MAX_LEN_FILE_W_PATH 75
 
-// GLOBAL VARS
-static FILE* g_fpLog = { NULL };
-static char g_sFileWithPath[MAX_LEN_FILE_W_PATH]; // FIXME make macro/defined
-// END GLOBAL VARS
+// space used to hold lines until the flush policy says to write them
+#define FILE_OUT_BUF_SIZE 65536
+
+// data for each file handler
+typedef struct {
+    int                 m_nFd;
+    char                m_sFileWithPath[MAX_LEN_FILE_W_PATH]; // FIXME make macro/defined
+    logger_flush_policy m_policy;
+    char*               m_sOutBuf;
+    size_t              m_nOutUsed;
+    uint64_t            m_nOldestNs;    // when the oldest line in m_sOutBuf was added
+    bool                m_bFlushNow;    // a line at or below the flush level is waiting
+    atomic_int          m_nFormat;
+    _Atomic(lgf_layout*) m_pLayout;
+} file_handler_ctx;
 
 // PRIVATE FUNCTION DECLARATIONS
-static int _file_handler_close();
-static int _file_handler_write(const t_loggermsg* p_sMsg);
+static int _file_handler_close(void* p_pContext);
+static int _file_handler_write(void* p_pContext, const t_loggermsg* p_sMsg);
+static int _file_handler_write_batch(void* p_pContext, const t_loggermsg** p_pMsgs, int p_nCount);
+static int _file_handler_flush(void* p_pContext, bool p_bForce);
+static void _file_handler_free(void* p_pContext);
+static int _file_handler_set_format(void* p_pContext, int p_nFormat);
+static int _file_handler_set_layout(void* p_pContext, const char* p_sPattern);
+static int _file_handler_add_line(file_handler_ctx* p_pCtx, const t_loggermsg* p_sMsg);
+static int _file_handler_write_out(file_handler_ctx* p_pCtx);
+static int _file_handler_writev(file_handler_ctx* p_pCtx, struct iovec* p_pIov, int p_nIovCount);
+static uint64_t _file_handler_now();
 // END PRIVATE FUNCTION DECLARATIONS
 
 // PRIVATE FUNCTION DEFINITIONS
-int _file_handler_close() {
+int _file_handler_close(void* p_pContext) {
 
-    if (g_fpLog == NULL) {
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    if (t_pCtx->m_nFd == -1) {
         return 1;
     }
-    fclose(g_fpLog);
-    g_fpLog = NULL;
+
+    // whatever is still buffered is written before the file is closed
+    _file_handler_write_out(t_pCtx);
+    close(t_pCtx->m_nFd);
+    t_pCtx->m_nFd = -1;
+
+    free(t_pCtx->m_sOutBuf);
+    t_pCtx->m_sOutBuf = NULL;
+    t_pCtx->m_nOutUsed = 0;
 
     return 0;
 }
 
-int _file_handler_write(const t_loggermsg* p_sMsg) {
+uint64_t _file_handler_now() {
+    struct timespec t_Now;
+    clock_gettime(CLOCK_MONOTONIC, &t_Now);
+    return ((uint64_t) t_Now.tv_sec * 1000000000) + t_Now.tv_nsec;
+}
+
+/*
+ * Writes every iovec, calling writev() again if it's interrupted or only
+ * writes part of the data.
+ */
+int _file_handler_writev(file_handler_ctx* p_pCtx, struct iovec* p_pIov, int p_nIovCount) {
+
+    while (p_nIovCount > 0) {
+        ssize_t t_nWritten = writev(p_pCtx->m_nFd, p_pIov, p_nIovCount);
+        if (t_nWritten < 0) {
+            if (errno == EINTR)
+                continue;
+            lgu_warn_msg_int("Failed to write to the log file; errno: %d", errno);
+            return 1;
+        }
+
+        // skip what was written
+        while ((p_nIovCount > 0) && ((size_t) t_nWritten >= p_pIov->iov_len)) {
+            t_nWritten -= p_pIov->iov_len;
+            p_pIov++;
+            p_nIovCount--;
+        }
+        if (p_nIovCount > 0) {
+            p_pIov->iov_base = (char*) p_pIov->iov_base + t_nWritten;
+            p_pIov->iov_len -= t_nWritten;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Writes everything in the output buffer to the file.
+ */
+int _file_handler_write_out(file_handler_ctx* p_pCtx) {
+
+    if (p_pCtx->m_nOutUsed == 0)
+        return 0;
+
+    struct iovec t_Iov = { p_pCtx->m_sOutBuf, p_pCtx->m_nOutUsed };
+    int t_nRtn = _file_handler_writev(p_pCtx, &t_Iov, 1);
+
+    // on failure the lines are dropped rather than retried forever
+    p_pCtx->m_nOutUsed = 0;
+    p_pCtx->m_bFlushNow = false;
+
+    return t_nRtn;
+}
+
+/*
+ * Adds a line to the output buffer, writing the buffer out first if the line
+ * doesn't fit. Lines too long for the buffer are written on their own.
+ *
+ * The length of a JSON line isn't known until it's written, so room is made
+ * for the longest it could be.
+ */
+int _file_handler_add_line(file_handler_ctx* p_pCtx, const t_loggermsg* p_sMsg) {
+
+    // NULL when the line is written as JSON
+    const lgf_layout* t_pLayout = NULL;
+    if (atomic_load_explicit(&p_pCtx->m_nFormat, memory_order_relaxed) != CLOGGER_FORMAT_JSON)
+        t_pLayout = atomic_load_explicit(&p_pCtx->m_pLayout, memory_order_acquire);
+
+    size_t t_nLineLen = (t_pLayout == NULL ? lgj_line_max_len(p_sMsg) : lgf_layout_len(t_pLayout, p_sMsg));
+
+    if ((p_pCtx->m_nOutUsed + t_nLineLen) > FILE_OUT_BUF_SIZE) {
+        if (_file_handler_write_out(p_pCtx))
+            return 1;
+    }
+
+    char* t_pLine;
+    if (t_nLineLen > FILE_OUT_BUF_SIZE) {
+        t_pLine = (char*) malloc(t_nLineLen);
+        if (t_pLine == NULL) {
+            fprintf(stderr, "Failed to allocate space for a line of the log file.\n");
+            return 1;
+        }
+    }
+    else {
+        if (p_pCtx->m_nOutUsed == 0)
+            p_pCtx->m_nOldestNs = _file_handler_now();
+        t_pLine = p_pCtx->m_sOutBuf + p_pCtx->m_nOutUsed;
+    }
+
+    char* t_pEnd;
+    if (t_pLayout == NULL)
+        t_pEnd = lgj_format_line(t_pLine, p_sMsg);
+    else
+        t_pEnd = lgf_render_layout(t_pLayout, t_pLine, p_sMsg);
+
+    if (t_nLineLen > FILE_OUT_BUF_SIZE) {
+        struct iovec t_Iov = { t_pLine, (size_t) (t_pEnd - t_pLine) };
+        int t_nRtn = _file_handler_writev(p_pCtx, &t_Iov, 1);
+        free(t_pLine);
+        return t_nRtn;
+    }
+
+    p_pCtx->m_nOutUsed = (size_t) (t_pEnd - p_pCtx->m_sOutBuf);
+
+    if (p_sMsg->m_nLogLevel <= p_pCtx->m_policy.flush_level)
+        p_pCtx->m_bFlushNow = true;
+
+    return 0;
+}
+
+/*
+ * Writes the output buffer to the file if p_bForce is set or the flush
+ * policy says it's time.
+ *
+ * Returns 1 if lines are still waiting to be written, 0 if there are none,
+ * or -1 on error.
+ */
+int _file_handler_flush(void* p_pContext, bool p_bForce) {
+
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    if (t_pCtx->m_nFd == -1)
+        return -1;
+    else if (t_pCtx->m_nOutUsed == 0)
+        return 0;
+
+    bool t_bFlush = p_bForce || t_pCtx->m_bFlushNow || (t_pCtx->m_nOutUsed >= t_pCtx->m_policy.max_bytes);
+    if (!t_bFlush && (t_pCtx->m_policy.interval_ms > 0)) {
+        uint64_t t_nAgeNs = _file_handler_now() - t_pCtx->m_nOldestNs;
+        t_bFlush = (t_nAgeNs >= ((uint64_t) t_pCtx->m_policy.interval_ms * 1000000));
+    }
+
+    if (!t_bFlush)
+        return 1;
+
+    return (_file_handler_write_out(t_pCtx) ? -1 : 0);
+}
+
+int _file_handler_write(void* p_pContext, const t_loggermsg* p_sMsg) {
+
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    if (t_pCtx->m_nFd == -1)
+        return 1;
 
-    if (g_fpLog == NULL)
+    if (_file_handler_add_line(t_pCtx, p_sMsg))
         return 1;
 
-    fprintf(g_fpLog, "%s%s %s\n", p_sMsg->m_sFormat, p_sMsg->m_sId, p_sMsg->m_sMsg);
-    fflush(g_fpLog);
+    return (_file_handler_flush(p_pContext, false) < 0 ? 1 : 0);
+}
+
+int _file_handler_write_batch(void* p_pContext, const t_loggermsg** p_pMsgs, int p_nCount) {
 
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    if (t_pCtx->m_nFd == -1)
+        return 1;
+
+    int t_nRtn = 0;
+    for (int count = 0; count < p_nCount; count++) {
+        if (_file_handler_add_line(t_pCtx, p_pMsgs[count]))
+            t_nRtn = 1;
+    }
+
+    if (_file_handler_flush(p_pContext, false) < 0)
+        t_nRtn = 1;
+
+    return t_nRtn;
+}
+
+int _file_handler_set_format(void* p_pContext, int p_nFormat) {
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    if ((p_nFormat != CLOGGER_FORMAT_TEXT) && (p_nFormat != CLOGGER_FORMAT_JSON))
+        return 1;
+    atomic_store_explicit(&t_pCtx->m_nFormat, p_nFormat, memory_order_relaxed);
     return 0;
 }
 
-int _file_handler_open() {
-    g_fpLog = fopen(g_sFileWithPath, "a"); // TODO make variable
+int _file_handler_set_layout(void* p_pContext, const char* p_sPattern) {
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    return lgf_replace_layout(&t_pCtx->m_pLayout, p_sPattern);
+}
+
+int _file_handler_open(void* p_pContext) {
+
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
 
-    if (g_fpLog == NULL) {
+    t_pCtx->m_sOutBuf = (char*) malloc(FILE_OUT_BUF_SIZE);
+    if (t_pCtx->m_sOutBuf == NULL) {
+        fprintf(stderr, "Failed to allocate space for the log file buffer.\n");
+        return 1;
+    }
+    t_pCtx->m_nOutUsed = 0;
+    t_pCtx->m_bFlushNow = false;
+
+    t_pCtx->m_nFd = open(t_pCtx->m_sFileWithPath, O_WRONLY | O_CREAT | O_APPEND, 0644); // TODO make variable
+
+    if (t_pCtx->m_nFd == -1) {
         // Failed to open the log file
         // FIXME include full path to file
-        fprintf(stderr, "Failed to open the log file at: %s\n", g_sFileWithPath);
+        fprintf(stderr, "Failed to open the log file at: %s\n", t_pCtx->m_sFileWithPath);
+        free(t_pCtx->m_sOutBuf);
+        t_pCtx->m_sOutBuf = NULL;
         return 1;
     }
     return 0;
 }
 
-int _file_handler_isOpen() {
-    if (g_fpLog != NULL) {
+int _file_handler_isOpen(void* p_pContext) {
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    if (t_pCtx->m_nFd != -1) {
         return 1;
     }
     else {
         return 0;
     }
 }
-// END PRIVATE FUNCTION DEFINITIONS
 
+void _file_handler_free(void* p_pContext) {
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) p_pContext;
+    if (t_pCtx->m_nFd != -1)
+        _file_handler_close(p_pContext);
+    lgf_free_layout(atomic_load(&t_pCtx->m_pLayout));
+    free(t_pCtx);
+}
+// END PRIVATE FUNCTION DEFINITIONS
 
-int create_file_handler(log_handler *p_pHandler, char* p_sLogLocation, char* p_sLogName) {
 
-    // FIXME can only support one file at a time right now
-    if (g_fpLog != NULL) {
-        fprintf(stderr, "Can't create file handler; there's already an active file handler.\n");
-        return 1;
-    }
+int create_file_handler(log_handler *p_pHandler, char* p_sLogLocation, char* p_sLogName, const logger_flush_policy* p_pPolicy) {
 
     // Check if p_sLogLocation is a directory
     if (p_sLogLocation != NULL) {
@@ -101,12 +323,25 @@ int create_file_handler(log_handler *p_pHandler, char* p_sLogLocation, char* p_s
     else
         t_sLogName = (char*) "log.log";
 
+    file_handler_ctx* t_pCtx = (file_handler_ctx*) malloc(sizeof(file_handler_ctx));
+    if (t_pCtx == NULL) {
+        fprintf(stderr, "Failed to allocate space for the file handler.\n");
+        return 1;
+    }
+    t_pCtx->m_nFd = -1;
+    t_pCtx->m_sOutBuf = NULL;
+    t_pCtx->m_nOutUsed = 0;
+    t_pCtx->m_nOldestNs = 0;
+    t_pCtx->m_bFlushNow = false;
+    atomic_init(&t_pCtx->m_nFormat, CLOGGER_FORMAT_TEXT);
+    atomic_init(&t_pCtx->m_pLayout, NULL);
+
     // FIXME need to check the sizes of p_sLogLocation and p_sLogName
 
     // try to open the log file
     {
         size_t sn_rtn = snprintf(
-            g_sFileWithPath,
+            t_pCtx->m_sFileWithPath,
             sizeof(char) * MAX_LEN_FILE_W_PATH,
             "%s/%s",
             p_sLogLocation,
@@ -115,19 +350,41 @@ int create_file_handler(log_handler *p_pHandler, char* p_sLogLocation, char* p_s
         if (sn_rtn >= sizeof(char) * MAX_LEN_FILE_W_PATH) {
             // the file with path was too long
             fprintf(stderr, "Cannot create file handler because file with path is too long.\n");
+            free(t_pCtx);
             return 1;
         }
     }
 
+    if (lgf_replace_layout(&t_pCtx->m_pLayout, FORMATTER_DEFAULT_LAYOUT)) {
+        free(t_pCtx);
+        return 1;
+    }
+
+    if (p_pPolicy != NULL) {
+        t_pCtx->m_policy = *p_pPolicy;
+    }
+    else {
+        // write each batch of lines as soon as it's received
+        t_pCtx->m_policy.max_bytes = 0;
+        t_pCtx->m_policy.interval_ms = 0;
+        t_pCtx->m_policy.flush_level = -1;
+    }
+
     log_handler t_structHandler = {
         &_file_handler_write,
         &_file_handler_close,
         &_file_handler_open,
         &_file_handler_isOpen,
         true,
-        true
+        true,
+        &_file_handler_write_batch,
+        &_file_handler_flush,
+        &_file_handler_set_format,
+        &_file_handler_set_layout,
+        &_file_handler_free,
+        t_pCtx
     };
-    
+
     // TODO can we check perms on the file without opening it? should we open and close
     // quickly to test?
 
@@ -135,4 +392,3 @@ int create_file_handler(log_handler *p_pHandler, char* p_sLogLocation, char* p_s
 
     return 0;
 }
-
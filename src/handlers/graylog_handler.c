@@ -1,115 +1,628 @@
+// sendmmsg() is Linux-specific
+#define _GNU_SOURCE
 
 #include "graylog_handler.h"
+#include "../logger_json.h"
 
 //#include <arpa/inet.h>
 #include <errno.h>  // to get error from send()
 #include <netdb.h>  // used by getaddrinfo()
+#include <poll.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h> // memset()
-//#include <sys/socket.h>
+#include <sys/socket.h> // sendmmsg()
+#include <time.h>
 #include <unistd.h>
 
 #define MAX_HOSTNAME_LEN 100
-#define GRAYLOG_MAX_MESSAGE_LENGTH CLOGGER_MAX_MESSAGE_SIZE + 150
 
-// GLOBAL VARS
-static int g_nSocket = { -1 };
-static char* g_sHostname = { NULL };
+// most messages sent by one call to sendmmsg()
+#define GRAYLOG_BATCH_SIZE 64
+
+/*
+ * UDP messages longer than this are split into GELF chunks of this size,
+ * header included. 1420 bytes fits in a packet on most networks; GELF allows
+ * up to 8192.
+ */
+#define GRAYLOG_UDP_CHUNK_SIZE 1420
+#define GRAYLOG_CHUNK_HEADER_SIZE 12
+#define GRAYLOG_MAX_CHUNKS 128
+
+// most datagrams handed to one sendmmsg()
+#define GRAYLOG_MAX_DATAGRAMS 256
+
+// space for a message's fields besides the escaped text, ID and hostname
+#define GRAYLOG_FIELDS_SIZE 160
+
+/*
+ * Most bytes held for a TCP connection that's down or slow. Messages that
+ * don't fit are dropped and counted in logger_stats.handler_dropped.
+ */
+#define GRAYLOG_TCP_MAX_PENDING (4 * 1024 * 1024)
+
+// time between attempts to connect; doubles after each failure
+#define GRAYLOG_RETRY_MIN_MS 100
+#define GRAYLOG_RETRY_MAX_MS 30000
+
+// how long the handler keeps trying to send what it's holding when it's closed
+#define GRAYLOG_CLOSE_WAIT_MS 1000
+
+// states of the connection to the server
+#define GRAYLOG_DISCONNECTED 0
+#define GRAYLOG_CONNECTING 1
+#define GRAYLOG_CONNECTED 2
+
+// data for each Graylog handler
+typedef struct {
+    int     m_nSocket;
+    int     m_nProtocol;
+    char    m_sHostname[LGJ_ESCAPED_MAX_LEN(MAX_HOSTNAME_LEN)];  // escaped for JSON
+    uint64_t m_nNextChunkId;
+
+    // the server's addresses, found when the handler was created
+    struct addrinfo* m_pAddrs;
+    bool    m_bOpen;            // open() was called and close() hasn't been
+    int     m_nState;
+    uint64_t m_nRetryMs;        // when to try connecting again (CLOCK_MONOTONIC)
+    int     m_nBackoffMs;
 
-static const char* g_sGraylogMsgFormat =
-    "{"
-        "\"short_message\":\"%s\", "
-        "\"host\":\"%s\", "
-        "\"facility\":\"test\","
-        "\"level\":%d"
-    "}";
-// END GLOBAL VARS
+    /*
+     * The GELF messages for a batch, each followed by a null character. Over
+     * TCP messages are added after the ones that haven't been sent yet, which
+     * are the bytes from m_nPendStart to m_nPendEnd. m_bPartSent is set while
+     * the message at m_nPendStart has only been partly sent.
+     */
+    char*   m_pOut;
+    size_t  m_nOutSize;
+    size_t  m_nOffsets[GRAYLOG_BATCH_SIZE + 1];
+    size_t  m_nPendStart;
+    size_t  m_nPendEnd;
+    bool    m_bPartSent;
+
+    /*
+     * Datagrams waiting for sendmmsg(); chunks have a header and part of a
+     * message. m_bMsgEnd is set for the last datagram of each message, so
+     * messages that aren't sent can be counted.
+     */
+    struct mmsghdr m_Datagrams[GRAYLOG_MAX_DATAGRAMS];
+    struct iovec   m_DatagramIovs[GRAYLOG_MAX_DATAGRAMS][2];
+    char           m_sChunkHeaders[GRAYLOG_MAX_DATAGRAMS][GRAYLOG_CHUNK_HEADER_SIZE];
+    bool           m_bMsgEnd[GRAYLOG_MAX_DATAGRAMS];
+    int            m_nDatagrams;
+} graylog_handler_ctx;
 
 // PRIVATE FUNCTION DECLARATIONS
-static int _graylog_handler_close();
-static int _graylog_handler_open();
-static int _graylog_handler_isOpen();
-static int _graylog_handler_write(const t_loggermsg* p_sMsg);
+static int _graylog_handler_close(void* p_pContext);
+static int _graylog_handler_open(void* p_pContext);
+static int _graylog_handler_isOpen(void* p_pContext);
+static int _graylog_handler_write(void* p_pContext, const t_loggermsg* p_sMsg);
+static int _graylog_handler_write_batch(void* p_pContext, const t_loggermsg** p_pMsgs, int p_nCount);
+static int _graylog_handler_flush(void* p_pContext, bool p_bForce);
+static void _graylog_handler_free(void* p_pContext);
+static uint64_t _graylog_handler_now_ms();
+static void _graylog_handler_connect(graylog_handler_ctx* p_pCtx);
+static void _graylog_handler_disconnect(graylog_handler_ctx* p_pCtx);
+static int _graylog_handler_drain(graylog_handler_ctx* p_pCtx, int p_nWaitMs);
+static int _graylog_handler_encode(graylog_handler_ctx* p_pCtx, const t_loggermsg* p_sMsg, size_t p_nOffset);
+static int _graylog_handler_add_datagram(graylog_handler_ctx* p_pCtx, const char* p_pHeader, const char* p_pData, size_t p_nLen, bool p_bMsgEnd);
+static int _graylog_handler_send_datagrams(graylog_handler_ctx* p_pCtx);
+static int _graylog_handler_send_udp(graylog_handler_ctx* p_pCtx, const t_loggermsg** p_pMsgs, int p_nCount);
+static int _graylog_handler_queue_tcp(graylog_handler_ctx* p_pCtx, const t_loggermsg** p_pMsgs, int p_nCount);
 // END PRIVATE FUNCTION DECLARATIONS
 
 // PRIVATE FUNCTION DEFINITIONS
-int _graylog_handler_close() {
 
-    // make sure the socket has been opened
-    if (g_nSocket == -1) {
+/*
+ * Tries to send what's being held, then closes the socket. Messages that
+ * still couldn't be sent are counted as dropped.
+ */
+int _graylog_handler_close(void* p_pContext) {
+
+    graylog_handler_ctx* t_pCtx = (graylog_handler_ctx*) p_pContext;
+
+    if (!t_pCtx->m_bOpen) {
         fprintf(stderr, "Socket was not open.\n");
         // is this an error? the end result is that the socket isn't open...
         return 0;
     }
 
-    if (close(g_nSocket) != 0) {
+    if (_graylog_handler_drain(t_pCtx, GRAYLOG_CLOSE_WAIT_MS) > 0) {
+        unsigned long t_nLost = 0;
+        for (size_t count = t_pCtx->m_nPendStart; count < t_pCtx->m_nPendEnd; count++) {
+            if (t_pCtx->m_pOut[count] == '\0')
+                t_nLost++;
+        }
+        lgh_add_dropped(t_nLost);
+    }
+    t_pCtx->m_nPendStart = 0;
+    t_pCtx->m_nPendEnd = 0;
+    t_pCtx->m_bPartSent = false;
+
+    int t_nRtn = 0;
+    if ((t_pCtx->m_nSocket != -1) && (close(t_pCtx->m_nSocket) != 0)) {
         fprintf(stderr, "Failed to close the socket. Error: %d\n", errno);
-        return 1;
+        t_nRtn = 1;
+    }
+
+    t_pCtx->m_nSocket = -1; // mark that the socket is not open
+    t_pCtx->m_nState = GRAYLOG_DISCONNECTED;
+    t_pCtx->m_bOpen = false;
+
+    return t_nRtn;
+}
+
+/*
+ * Starts connecting to the server without waiting for it. If the server
+ * can't be reached, the handler keeps trying as messages are written, so
+ * this doesn't fail.
+ */
+int _graylog_handler_open(void* p_pContext) {
+    graylog_handler_ctx* t_pCtx = (graylog_handler_ctx*) p_pContext;
+    t_pCtx->m_bOpen = true;
+    t_pCtx->m_nBackoffMs = GRAYLOG_RETRY_MIN_MS;
+    _graylog_handler_connect(t_pCtx);
+    return 0;
+}
+
+// the handler stays open while the server is unreachable, holding messages for it
+int _graylog_handler_isOpen(void* p_pContext) {
+    graylog_handler_ctx* t_pCtx = (graylog_handler_ctx*) p_pContext;
+    return t_pCtx->m_bOpen;
+}
+
+int _graylog_handler_write(void* p_pContext, const t_loggermsg* p_sMsg) {
+    return _graylog_handler_write_batch(p_pContext, &p_sMsg, 1);
+}
+
+// sends what the TCP connection can take right now
+int _graylog_handler_flush(void* p_pContext, bool p_bForce) {
+    graylog_handler_ctx* t_pCtx = (graylog_handler_ctx*) p_pContext;
+    return _graylog_handler_drain(t_pCtx, (p_bForce ? GRAYLOG_CLOSE_WAIT_MS : 0));
+}
+
+void _graylog_handler_free(void* p_pContext) {
+    graylog_handler_ctx* t_pCtx = (graylog_handler_ctx*) p_pContext;
+    if (t_pCtx->m_bOpen)
+        _graylog_handler_close(p_pContext);
+    freeaddrinfo(t_pCtx->m_pAddrs);
+    free(t_pCtx->m_pOut);
+    free(t_pCtx);
+}
+
+uint64_t _graylog_handler_now_ms() {
+    struct timespec t_Now;
+    clock_gettime(CLOCK_MONOTONIC, &t_Now);
+    return ((uint64_t) t_Now.tv_sec * 1000) + (t_Now.tv_nsec / 1000000);
+}
+
+/*
+ * Creates a non-blocking socket and starts connecting it to the first of the
+ * server's addresses that will take one. A TCP connection usually finishes
+ * later; _graylog_handler_drain() checks on it.
+ */
+void _graylog_handler_connect(graylog_handler_ctx* p_pCtx) {
+
+    for (struct addrinfo* t_pAddr = p_pCtx->m_pAddrs; t_pAddr != NULL; t_pAddr = t_pAddr->ai_next) {
+
+        int t_nSocket = socket(t_pAddr->ai_family, t_pAddr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, t_pAddr->ai_protocol);
+        if (t_nSocket == -1)
+            continue;   // couldn't create a socket; try the next address
+
+        if (connect(t_nSocket, t_pAddr->ai_addr, t_pAddr->ai_addrlen) == 0) {
+            p_pCtx->m_nSocket = t_nSocket;
+            p_pCtx->m_nState = GRAYLOG_CONNECTED;
+            p_pCtx->m_nBackoffMs = GRAYLOG_RETRY_MIN_MS;
+            return;
+        }
+        else if (errno == EINPROGRESS) {
+            p_pCtx->m_nSocket = t_nSocket;
+            p_pCtx->m_nState = GRAYLOG_CONNECTING;
+            return;
+        }
+
+        close(t_nSocket);
+    }
+
+    // nothing would take a connection; try again later
+    p_pCtx->m_nState = GRAYLOG_DISCONNECTED;
+    p_pCtx->m_nRetryMs = _graylog_handler_now_ms() + p_pCtx->m_nBackoffMs;
+    p_pCtx->m_nBackoffMs = (p_pCtx->m_nBackoffMs * 2 < GRAYLOG_RETRY_MAX_MS ? p_pCtx->m_nBackoffMs * 2 : GRAYLOG_RETRY_MAX_MS);
+}
+
+/*
+ * Closes a connection that failed and schedules the next attempt. If a
+ * message was only partly sent, the rest of it is dropped so the next
+ * connection starts on a whole message.
+ */
+void _graylog_handler_disconnect(graylog_handler_ctx* p_pCtx) {
+
+    if (p_pCtx->m_nSocket != -1)
+        close(p_pCtx->m_nSocket);
+    p_pCtx->m_nSocket = -1;
+    p_pCtx->m_nState = GRAYLOG_DISCONNECTED;
+    p_pCtx->m_nRetryMs = _graylog_handler_now_ms() + p_pCtx->m_nBackoffMs;
+    p_pCtx->m_nBackoffMs = (p_pCtx->m_nBackoffMs * 2 < GRAYLOG_RETRY_MAX_MS ? p_pCtx->m_nBackoffMs * 2 : GRAYLOG_RETRY_MAX_MS);
+
+    if (p_pCtx->m_bPartSent) {
+        char* t_pEnd = memchr(p_pCtx->m_pOut + p_pCtx->m_nPendStart, '\0', p_pCtx->m_nPendEnd - p_pCtx->m_nPendStart);
+        p_pCtx->m_nPendStart = (size_t) (t_pEnd - p_pCtx->m_pOut) + 1;
+        p_pCtx->m_bPartSent = false;
+        lgh_add_dropped(1);
+    }
+}
+
+/*
+ * Sends held TCP messages until they're all sent, the socket can't take more,
+ * or p_nWaitMs pass. Connects again when the connection has failed and it's
+ * time for another attempt.
+ *
+ * Returns 1 if messages are still waiting, 0 if none are.
+ */
+int _graylog_handler_drain(graylog_handler_ctx* p_pCtx, int p_nWaitMs) {
+
+    if (p_pCtx->m_nProtocol != GRAYLOG_TCP)
+        return 0;
+
+    uint64_t t_nNow = _graylog_handler_now_ms();
+    uint64_t t_nDeadline = t_nNow + (uint64_t) p_nWaitMs;
+
+    while (p_pCtx->m_nPendStart < p_pCtx->m_nPendEnd) {
+
+        if (p_pCtx->m_nState == GRAYLOG_DISCONNECTED) {
+            if (t_nNow < p_pCtx->m_nRetryMs) {
+                if (t_nNow >= t_nDeadline)
+                    return 1;
+                uint64_t t_nSleepUntil = (p_pCtx->m_nRetryMs < t_nDeadline ? p_pCtx->m_nRetryMs : t_nDeadline);
+                poll(NULL, 0, (int) (t_nSleepUntil - t_nNow));
+            }
+            else {
+                _graylog_handler_connect(p_pCtx);
+            }
+            t_nNow = _graylog_handler_now_ms();
+            continue;
+        }
+
+        struct pollfd t_Poll = { p_pCtx->m_nSocket, POLLOUT, 0 };
+        int t_nPollRtn = poll(&t_Poll, 1, (t_nNow < t_nDeadline ? (int) (t_nDeadline - t_nNow) : 0));
+        if (t_nPollRtn == 0) {
+            return 1;   // the socket can't take any more yet
+        }
+        else if (t_nPollRtn < 0) {
+            if (errno != EINTR)
+                return 1;
+        }
+        else if (p_pCtx->m_nState == GRAYLOG_CONNECTING) {
+            int t_nError = 0;
+            socklen_t t_nErrorLen = sizeof(int);
+            if ((getsockopt(p_pCtx->m_nSocket, SOL_SOCKET, SO_ERROR, &t_nError, &t_nErrorLen) != 0) || (t_nError != 0)) {
+                _graylog_handler_disconnect(p_pCtx);
+            }
+            else {
+                p_pCtx->m_nState = GRAYLOG_CONNECTED;
+                p_pCtx->m_nBackoffMs = GRAYLOG_RETRY_MIN_MS;
+            }
+        }
+        else {
+            ssize_t t_nSent = send(p_pCtx->m_nSocket, p_pCtx->m_pOut + p_pCtx->m_nPendStart,
+                p_pCtx->m_nPendEnd - p_pCtx->m_nPendStart, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (t_nSent > 0) {
+                p_pCtx->m_nPendStart += (size_t) t_nSent;
+                // every message ends with a null character, so this stops mid-message unless the last byte sent was one
+                p_pCtx->m_bPartSent = (p_pCtx->m_pOut[p_pCtx->m_nPendStart - 1] != '\0');
+            }
+            else if ((t_nSent < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                _graylog_handler_disconnect(p_pCtx);
+            }
+        }
+
+        t_nNow = _graylog_handler_now_ms();
+    }
+
+    p_pCtx->m_nPendStart = 0;
+    p_pCtx->m_nPendEnd = 0;
+    p_pCtx->m_bPartSent = false;
+    return 0;
+}
+
+/*
+ * Writes the GELF 1.1 message for p_sMsg, followed by a null character, at
+ * p_nOffset in the output buffer, growing the buffer if it's needed.
+ *
+ * Returns the length of the message without the null character, or -1 on
+ * failure.
+ */
+int _graylog_handler_encode(graylog_handler_ctx* p_pCtx, const t_loggermsg* p_sMsg, size_t p_nOffset) {
+
+    // the ID is padded to line up with the others; Graylog doesn't need that
+    size_t t_nIdLen = (size_t) p_sMsg->m_nIdLen;
+    while ((t_nIdLen > 0) && (p_sMsg->m_sId[t_nIdLen - 1] == ' '))
+        t_nIdLen--;
+
+    size_t t_nMaxLen = GRAYLOG_FIELDS_SIZE + strlen(p_pCtx->m_sHostname) + LGJ_ESCAPED_MAX_LEN((size_t) p_sMsg->m_nMsgLen + t_nIdLen);
+    if ((p_nOffset + t_nMaxLen) > p_pCtx->m_nOutSize) {
+        size_t t_nSize = (p_pCtx->m_nOutSize > 0 ? p_pCtx->m_nOutSize : 4096);
+        while (t_nSize < (p_nOffset + t_nMaxLen))
+            t_nSize *= 2;
+        char* t_pOut = (char*) realloc(p_pCtx->m_pOut, t_nSize);
+        if (t_pOut == NULL) {
+            fprintf(stderr, "Failed to allocate space for a message to Graylog.\n");
+            return -1;
+        }
+        p_pCtx->m_pOut = t_pOut;
+        p_pCtx->m_nOutSize = t_nSize;
+    }
+
+    char* t_pStart = p_pCtx->m_pOut + p_nOffset;
+    char* t_pDest = t_pStart;
+
+    static const char t_sVersion[] = "{\"version\":\"1.1\",\"host\":\"";
+    memcpy(t_pDest, t_sVersion, sizeof(t_sVersion) - 1);
+    t_pDest += sizeof(t_sVersion) - 1;
+    size_t t_nHostLen = strlen(p_pCtx->m_sHostname);
+    memcpy(t_pDest, p_pCtx->m_sHostname, t_nHostLen);
+    t_pDest += t_nHostLen;
+
+    static const char t_sShortMsg[] = "\",\"short_message\":\"";
+    memcpy(t_pDest, t_sShortMsg, sizeof(t_sShortMsg) - 1);
+    t_pDest += sizeof(t_sShortMsg) - 1;
+    t_pDest = lgj_escape(t_pDest, p_sMsg->m_sMsg, (size_t) p_sMsg->m_nMsgLen);
+
+    static const char t_sId[] = "\",\"_logger_id\":\"";
+    memcpy(t_pDest, t_sId, sizeof(t_sId) - 1);
+    t_pDest += sizeof(t_sId) - 1;
+    t_pDest = lgj_escape(t_pDest, p_sMsg->m_sId, t_nIdLen);
+
+    // GELF levels are the syslog levels, which the logger's levels already are
+    size_t t_nLeft = t_nMaxLen - (size_t) (t_pDest - t_pStart);
+    int t_nTail;
+    if (p_sMsg->m_nTimestamp != 0) {
+        t_nTail = snprintf(t_pDest, t_nLeft, "\",\"level\":%d,\"timestamp\":%llu.%06llu}",
+            p_sMsg->m_nLogLevel,
+            (unsigned long long) (p_sMsg->m_nTimestamp / 1000000000),
+            (unsigned long long) ((p_sMsg->m_nTimestamp % 1000000000) / 1000));
+    }
+    else {
+        t_nTail = snprintf(t_pDest, t_nLeft, "\",\"level\":%d}", p_sMsg->m_nLogLevel);
     }
+    if ((t_nTail < 0) || ((size_t) t_nTail >= t_nLeft)) {
+        fprintf(stderr, "Failed to encode a message for Graylog.\n");
+        return -1;
+    }
+    t_pDest += t_nTail;
+    *t_pDest = '\0';
+
+    return (int) (t_pDest - t_pStart);
+}
 
-    g_nSocket = -1; // mark that the socket is not open
+/*
+ * Queues a datagram for _graylog_handler_send_datagrams(), sending the ones
+ * already queued first if there's no room. p_pHeader is NULL for a message
+ * that isn't chunked, and p_bMsgEnd is set for the last datagram of a message.
+ */
+int _graylog_handler_add_datagram(graylog_handler_ctx* p_pCtx, const char* p_pHeader, const char* p_pData, size_t p_nLen, bool p_bMsgEnd) {
+
+    if (p_pCtx->m_nDatagrams == GRAYLOG_MAX_DATAGRAMS) {
+        int t_nRtn = _graylog_handler_send_datagrams(p_pCtx);
+        if (t_nRtn)
+            return t_nRtn;
+    }
+
+    int t_nIndex = p_pCtx->m_nDatagrams++;
+    struct iovec* t_pIovs = p_pCtx->m_DatagramIovs[t_nIndex];
+    int t_nIovs = 0;
+    if (p_pHeader != NULL) {
+        memcpy(p_pCtx->m_sChunkHeaders[t_nIndex], p_pHeader, GRAYLOG_CHUNK_HEADER_SIZE);
+        t_pIovs[t_nIovs].iov_base = p_pCtx->m_sChunkHeaders[t_nIndex];
+        t_pIovs[t_nIovs].iov_len = GRAYLOG_CHUNK_HEADER_SIZE;
+        t_nIovs++;
+    }
+    t_pIovs[t_nIovs].iov_base = (void*) p_pData;
+    t_pIovs[t_nIovs].iov_len = p_nLen;
+    t_nIovs++;
 
-    free(g_sHostname);
+    memset(&p_pCtx->m_Datagrams[t_nIndex], 0, sizeof(struct mmsghdr));
+    p_pCtx->m_Datagrams[t_nIndex].msg_hdr.msg_iov = t_pIovs;
+    p_pCtx->m_Datagrams[t_nIndex].msg_hdr.msg_iovlen = t_nIovs;
+    p_pCtx->m_bMsgEnd[t_nIndex] = p_bMsgEnd;
 
     return 0;
 }
 
-int _graylog_handler_open() {
-    // FIXME this should be where the socket is actually opened
+/*
+ * Hands every queued datagram to the kernel. Datagrams the socket has no room
+ * for are dropped rather than waited on, and the messages they belong to are
+ * counted. A message whose first chunks were sent but whose last one wasn't
+ * is left for the caller to count.
+ */
+int _graylog_handler_send_datagrams(graylog_handler_ctx* p_pCtx) {
+
+    int t_nSent = 0;
+    bool t_bRetried = false;
+    while (t_nSent < p_pCtx->m_nDatagrams) {
+        int t_nRtnSent = sendmmsg(p_pCtx->m_nSocket, p_pCtx->m_Datagrams + t_nSent, p_pCtx->m_nDatagrams - t_nSent, MSG_DONTWAIT);
+        if (t_nRtnSent < 0) {
+            if (errno == EINTR)
+                continue;
+            else if ((errno == ECONNREFUSED) && !t_bRetried) {
+                /*
+                 * an earlier datagram wasn't received; the server may be
+                 * restarting. The error is cleared once it's reported, and
+                 * this datagram wasn't sent, so try it again.
+                 */
+                t_bRetried = true;
+                continue;
+            }
+            else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ECONNREFUSED))
+                fprintf(stderr, "Error trying to send a message. Error number; %d\n", errno);
+
+            unsigned long t_nLost = 0;
+            for (int count = t_nSent; count < p_pCtx->m_nDatagrams; count++) {
+                if (p_pCtx->m_bMsgEnd[count])
+                    t_nLost++;
+            }
+            lgh_add_dropped(t_nLost);
+            p_pCtx->m_nDatagrams = 0;
+            return 2;
+        }
+        t_nSent += t_nRtnSent;
+        t_bRetried = false;
+    }
+
+    p_pCtx->m_nDatagrams = 0;
     return 0;
 }
 
-int _graylog_handler_isOpen() {
-    // FIXME this should actually check if the socket has been opened
-    // return 1 so passes if() checks
-    return 1;
+/*
+ * Encodes up to GRAYLOG_BATCH_SIZE messages next to each other in the output
+ * buffer and sends them as datagrams. A message that doesn't fit in one is
+ * split into GELF chunks, which all start with the same 8-byte ID followed by
+ * their position and the number of chunks.
+ */
+int _graylog_handler_send_udp(graylog_handler_ctx* p_pCtx, const t_loggermsg** p_pMsgs, int p_nCount) {
+
+    int t_nMsgs = 0;
+    int t_nRtn = 0;
+
+    p_pCtx->m_nOffsets[0] = 0;
+    for (int count = 0; count < p_nCount; count++) {
+        int t_nLen = _graylog_handler_encode(p_pCtx, p_pMsgs[count], p_pCtx->m_nOffsets[t_nMsgs]);
+        if (t_nLen < 0) {
+            lgh_add_dropped(1);
+            t_nRtn = 1;
+            continue;
+        }
+        p_pCtx->m_nOffsets[t_nMsgs + 1] = p_pCtx->m_nOffsets[t_nMsgs] + (size_t) t_nLen + 1;
+        t_nMsgs++;
+    }
+
+    const size_t t_nChunkData = GRAYLOG_UDP_CHUNK_SIZE - GRAYLOG_CHUNK_HEADER_SIZE;
+
+    for (int count = 0; count < t_nMsgs; count++) {
+        const char* t_pMsg = p_pCtx->m_pOut + p_pCtx->m_nOffsets[count];
+        size_t t_nLen = p_pCtx->m_nOffsets[count + 1] - p_pCtx->m_nOffsets[count] - 1;
+
+        int t_nAddRtn = 0;
+        if (t_nLen <= GRAYLOG_UDP_CHUNK_SIZE) {
+            t_nAddRtn = _graylog_handler_add_datagram(p_pCtx, NULL, t_pMsg, t_nLen, true);
+        }
+        else {
+            size_t t_nChunks = (t_nLen + t_nChunkData - 1) / t_nChunkData;
+            if (t_nChunks > GRAYLOG_MAX_CHUNKS) {
+                fprintf(stderr, "The message to be sent to Graylog exceeds the maximum size allowed.\n");
+                lgh_add_dropped(1);
+                t_nRtn = 1;
+                continue;
+            }
+
+            char t_sHeader[GRAYLOG_CHUNK_HEADER_SIZE];
+            t_sHeader[0] = 0x1e;
+            t_sHeader[1] = 0x0f;
+            uint64_t t_nChunkId = p_pCtx->m_nNextChunkId++;
+            memcpy(t_sHeader + 2, &t_nChunkId, sizeof(uint64_t));
+            t_sHeader[11] = (char) t_nChunks;
+
+            for (size_t t_nChunk = 0; (t_nChunk < t_nChunks) && (t_nAddRtn == 0); t_nChunk++) {
+                size_t t_nStart = t_nChunk * t_nChunkData;
+                size_t t_nPart = ((t_nLen - t_nStart) < t_nChunkData ? (t_nLen - t_nStart) : t_nChunkData);
+                t_sHeader[10] = (char) t_nChunk;
+                t_nAddRtn = _graylog_handler_add_datagram(p_pCtx, t_sHeader, t_pMsg + t_nStart, t_nPart, (t_nChunk == t_nChunks - 1));
+            }
+        }
+        if (t_nAddRtn) {
+            // the datagrams already queued were counted; this message and the rest weren't
+            lgh_add_dropped((unsigned long) (t_nMsgs - count));
+            return t_nAddRtn;
+        }
+    }
+
+    int t_nSendRtn = _graylog_handler_send_datagrams(p_pCtx);
+    return (t_nSendRtn ? t_nSendRtn : t_nRtn);
 }
 
-int _graylog_handler_write(const t_loggermsg* p_sMsg) {
+/*
+ * Adds messages after the ones that are waiting to be sent over TCP, then
+ * sends what the connection will take without waiting. GELF over TCP ends
+ * each message with a null character, which the encoder already wrote.
+ *
+ * Returns 1 if any messages were dropped because too much was waiting.
+ */
+int _graylog_handler_queue_tcp(graylog_handler_ctx* p_pCtx, const t_loggermsg** p_pMsgs, int p_nCount) {
+
+    // move what's waiting to the front, so the buffer never holds much more than GRAYLOG_TCP_MAX_PENDING
+    if (p_pCtx->m_nPendStart > 0) {
+        memmove(p_pCtx->m_pOut, p_pCtx->m_pOut + p_pCtx->m_nPendStart, p_pCtx->m_nPendEnd - p_pCtx->m_nPendStart);
+        p_pCtx->m_nPendEnd -= p_pCtx->m_nPendStart;
+        p_pCtx->m_nPendStart = 0;
+    }
 
-    // make sure the socket has been opened
-    if (g_nSocket == -1)
-        return 1;
+    unsigned long t_nDropped = 0;
+    for (int count = 0; count < p_nCount; count++) {
+        int t_nLen = _graylog_handler_encode(p_pCtx, p_pMsgs[count], p_pCtx->m_nPendEnd);
+        if ((t_nLen < 0) || ((p_pCtx->m_nPendEnd + (size_t) t_nLen + 1 - p_pCtx->m_nPendStart) > GRAYLOG_TCP_MAX_PENDING)) {
+            t_nDropped++;
+            continue;
+        }
+        p_pCtx->m_nPendEnd += (size_t) t_nLen + 1;
+    }
+
+    if (t_nDropped > 0)
+        lgh_add_dropped(t_nDropped);
+
+    _graylog_handler_drain(p_pCtx, 0);
 
-    char msg[GRAYLOG_MAX_MESSAGE_LENGTH];
-    // TODO check the length of p_sMsg
-    if (snprintf(msg, GRAYLOG_MAX_MESSAGE_LENGTH, g_sGraylogMsgFormat, p_sMsg, g_sHostname, p_sMsg->m_nLogLevel) >= GRAYLOG_MAX_MESSAGE_LENGTH) {
-        fprintf(stderr, "The formatted message to be sent to Graylog exceed the maximum size allowed.\n");
+    return (t_nDropped > 0);
+}
+
+int _graylog_handler_write_batch(void* p_pContext, const t_loggermsg** p_pMsgs, int p_nCount) {
+
+    graylog_handler_ctx* t_pCtx = (graylog_handler_ctx*) p_pContext;
+
+    if (!t_pCtx->m_bOpen)
         return 1;
+
+    if (t_pCtx->m_nProtocol == GRAYLOG_TCP)
+        return _graylog_handler_queue_tcp(t_pCtx, p_pMsgs, p_nCount);
+
+    // nothing is held for UDP, but the socket may still need to be created
+    if (t_pCtx->m_nState == GRAYLOG_DISCONNECTED) {
+        if (_graylog_handler_now_ms() >= t_pCtx->m_nRetryMs)
+            _graylog_handler_connect(t_pCtx);
+        if (t_pCtx->m_nState == GRAYLOG_DISCONNECTED) {
+            lgh_add_dropped((unsigned long) p_nCount);
+            return 1;
+        }
     }
-    // send() and write() are equivalent, except send() supports flags; when flags == 0, send() is the same as write()
-//  printf("%s\n", msg);
-    if (send(g_nSocket, msg, strlen(msg) , 0 ) == -1) {
-        fprintf(stderr, "Error trying to send a message. Error number; %d\n", errno);
-        return 2;
+
+    int t_nRtn = 0;
+    for (int count = 0; count < p_nCount; count += GRAYLOG_BATCH_SIZE) {
+        int t_nBatch = ((p_nCount - count) < GRAYLOG_BATCH_SIZE ? (p_nCount - count) : GRAYLOG_BATCH_SIZE);
+        int t_nSendRtn = _graylog_handler_send_udp(t_pCtx, p_pMsgs + count, t_nBatch);
+        if (t_nSendRtn > 1)
+            return t_nSendRtn;
+        else if (t_nSendRtn)
+            t_nRtn = t_nSendRtn;
     }
-    send(g_nSocket, "\0", sizeof(char), 0);
 
-    return 0;
+    return t_nRtn;
 }
 // END PRIVATE FUNCTION DEFINITIONS
 
+/*
+ * Looks up the server's addresses on the calling thread so a bad name is
+ * reported right away. The socket is created by _graylog_handler_open() on
+ * the thread that writes to the handler.
+ */
 int create_graylog_handler(log_handler *p_pHandler, char* p_sServer, int p_nPort, int p_nProtocol) {
 
-    /*
-     * FIXME
-     * The socket shouldn't actually be opened here since the handler will
-     * be created by a different thread than the one that will write to it.
-     *
-     * Most likely need to implement a void* inside the log_handler object.
-     * Each handler function will also take a pointer to a handler. Each
-     * handler can then access data that's specific to it in the functions that
-     * are acting on it.
-     */
-
     if (p_pHandler == NULL) {
         fprintf(stderr, "Can't initialize a NULL handler.\n");
         return 1;
     }
 
     struct addrinfo t_addrinfoHints;
-    struct addrinfo *t_pResult, *t_pResultItr;
-    int t_nSocket, t_nAddrInfoRtn;
+    struct addrinfo *t_pResult;
+    int t_nAddrInfoRtn;
 
     // 0-out the hints struct
     memset(&t_addrinfoHints, 0, sizeof(struct addrinfo));
@@ -148,49 +661,44 @@ int create_graylog_handler(log_handler *p_pHandler, char* p_sServer, int p_nPort
         return 1;
     }
 
-    // iterate over the list of address structures
-    for (t_pResultItr = t_pResult; t_pResultItr != NULL; t_pResultItr = t_pResultItr->ai_next) {
-
-        // create a socket for the address
-        t_nSocket = socket(t_pResultItr->ai_family, t_pResultItr->ai_socktype, t_pResultItr->ai_protocol);
-
-        if (t_nSocket == -1)
-            continue;   // couldn't create a socket; continue looping
-
-        // try to connect using the socket
-        if (connect(t_nSocket, t_pResultItr->ai_addr, t_pResultItr->ai_addrlen) != -1)
-            break; // success
-
-        // failed to connect above; close the socket
-        close(t_nSocket);
-    }
-
-    if (t_pResultItr == NULL) {
-        fprintf(stderr, "Could not bind.\n");
-        // should we free t_pResult?
+    graylog_handler_ctx* t_pCtx = (graylog_handler_ctx*) malloc(sizeof(graylog_handler_ctx));
+    if (t_pCtx == NULL) {
+        fprintf(stderr, "Failed to allocate space for the Graylog handler.\n");
+        freeaddrinfo(t_pResult);
         return 1;
     }
-
-    // t_pResultItr != NULL, so we broke from the for loop; the socket is open
-
-    // no longer need the address info that was returned since we have opened the socket
-    freeaddrinfo(t_pResult);
-
-    g_nSocket = t_nSocket;
+    t_pCtx->m_nSocket = -1;
+    t_pCtx->m_nProtocol = p_nProtocol;
+    t_pCtx->m_pAddrs = t_pResult;
+    t_pCtx->m_bOpen = false;
+    t_pCtx->m_nState = GRAYLOG_DISCONNECTED;
+    t_pCtx->m_nRetryMs = 0;
+    t_pCtx->m_nBackoffMs = GRAYLOG_RETRY_MIN_MS;
+    t_pCtx->m_pOut = NULL;
+    t_pCtx->m_nOutSize = 0;
+    t_pCtx->m_nPendStart = 0;
+    t_pCtx->m_nPendEnd = 0;
+    t_pCtx->m_bPartSent = false;
+    t_pCtx->m_nDatagrams = 0;
+
+    // chunked messages from different processes shouldn't share IDs
+    struct timespec t_tsNow;
+    clock_gettime(CLOCK_REALTIME, &t_tsNow);
+    t_pCtx->m_nNextChunkId = ((uint64_t) getpid() << 48) ^ ((uint64_t) t_tsNow.tv_sec << 20) ^ (uint64_t) t_tsNow.tv_nsec;
 
     // get the hostname of the machine the logger is running on
-    g_sHostname = (char*) malloc(sizeof(char) * MAX_HOSTNAME_LEN);
-    g_sHostname[MAX_HOSTNAME_LEN - 1] = '\0';
+    char t_sHostname[MAX_HOSTNAME_LEN];
+    t_sHostname[MAX_HOSTNAME_LEN - 1] = '\0';
     int t_nGetHostnameRtn = -1;
-    // sets g_sHostname to the UNQUALIFIED hostname of the system; need more steps to get FQDN
-    if ((t_nGetHostnameRtn = gethostname(g_sHostname, MAX_HOSTNAME_LEN)) != 0) {
+    // sets t_sHostname to the UNQUALIFIED hostname of the system; need more steps to get FQDN
+    if ((t_nGetHostnameRtn = gethostname(t_sHostname, MAX_HOSTNAME_LEN - 1)) != 0) {
         fprintf(stderr, "Failed to get the hostname of the machine the logger is running on.\n");
         fprintf(stderr, "Error number: %d\n", errno);
-        if (g_sHostname != NULL)
-            free(g_sHostname);
+        freeaddrinfo(t_pResult);
+        free(t_pCtx);
         return 1;
     }
-    // we can now use t_nSocket with write() (and send()) to send messages
+    *lgj_escape(t_pCtx->m_sHostname, t_sHostname, strlen(t_sHostname)) = '\0';
 
     log_handler t_structHandler = {
         &_graylog_handler_write,
@@ -198,11 +706,16 @@ int create_graylog_handler(log_handler *p_pHandler, char* p_sServer, int p_nPort
         &_graylog_handler_open,
         &_graylog_handler_isOpen,
         false,
-        false
+        false,
+        &_graylog_handler_write_batch,
+        &_graylog_handler_flush,
+        NULL,
+        NULL,
+        &_graylog_handler_free,
+        t_pCtx
     };
 
     memcpy(p_pHandler, &t_structHandler, sizeof(log_handler));
 
     return 0;
 }
-
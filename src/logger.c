@@ -1,8 +1,12 @@
 
+// syscall() and SYS_gettid for the IDs of threads
+#define _GNU_SOURCE
+
 #include "logger.h"
 
 #include "handlers/console_handler.h"
 #include "handlers/file_handler.h"
+#include "logger_args.h"
 #include "logger_buffer.h"
 #include "logger_formatter.h"
 #ifdef CLOGGER_GRAYLOG
@@ -10,66 +14,116 @@
 #endif
 
 #include <errno.h>
+#include <limits.h>     // INT_MAX
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>     // for strcmp
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #define LOGGER_SLEEP_SECS 1
 
+// the most messages the logger thread takes off the buffer at once
+#define LOGGER_BATCH_SIZE 64
+
+// how long the logger thread waits for a handler when messages are waiting
+#define LOGGER_NO_HANDLER_PAUSE_MS 10
+
+// how often the logger thread checks if handlers holding messages should write them
+#define LOGGER_FLUSH_CHECK_MS 50
+
+// by default, how full the buffer gets before CLOGGER_OVERFLOW_DROP_BELOW_LEVEL starts dropping messages
+#define LOGGER_SHED_FILL_PERCENT 50
+
+// how long CLOGGER_OVERFLOW_OVERWRITE_OLDEST waits for the logger thread to finish a batch
+#define LOGGER_OVERWRITE_WAIT_MS 100
+
 // global variables
 static atomic_bool g_bExit = { false };
 static bool volatile g_logInit = { false };
-static int g_nLogLevel;
+static atomic_bool g_bDeferFormat = { false };
+static atomic_int g_nOverflowPolicy = { CLOGGER_OVERFLOW_DROP_NEWEST };
+static atomic_int g_nOverflowValue = { 0 };
+static int g_nShedPercent = { LOGGER_SHED_FILL_PERCENT };
+static size_t g_nThreadBufferBytes = { 0 };
 static pthread_t g_LogThread;
 
 static logger_formatter* g_lgformatter = { NULL };
 
 static int buf_refid = { -1 };
 
+/*
+ * Each thread's own buffer, when thread buffers are enabled. g_nInitCount
+ * changes every time the logger is started, so a thread notices when its
+ * buffer belonged to an earlier run. The key's destructor retires the buffer
+ * when the thread exits.
+ *
+ * g_bBuffersLive is set while the buffers exist. It's only changed, and the
+ * destructor only retires a buffer, while holding g_ThreadBufLock, so a
+ * thread exiting during logger_free() can't touch buffers being freed.
+ */
+static atomic_uint g_nInitCount = { 0 };
+static bool g_bBuffersLive = { false };
+static pthread_mutex_t g_ThreadBufLock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local int g_nThreadBufRef = { -1 };
+static _Thread_local unsigned int g_nThreadBufInit = { 0 };
+
+// the kernel's ID for the calling thread; 0 until the thread logs a message
+static _Thread_local int g_nThreadId = { 0 };
+static pthread_once_t g_ThreadKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t g_ThreadKey;
+
+// space used by the logger thread to hold the text of the messages it's writing
+static char* g_sRenderBuf = { NULL };
+static size_t g_nRenderBufSize = { 0 };
+
+// messages that weren't logged (or were removed) because the buffer was full
+static atomic_ulong g_nDropped = { 0 };
+static atomic_ulong g_nOverwritten = { 0 };
+static atomic_ulong g_nShed = { 0 };
+static atomic_ulong g_nTimedOut = { 0 };
+
 // TODO value below should be removed or determined based on what the handlers require
 static bool volatile g_bTimestampEnabled = { true };
 
 const logger_id CLOGGER_DEFAULT_ID = { 0 };
+int g_nCloggerLogLevel = { -1 };    // only use with __atomic builtins; see clogger.h
+int g_nCloggerDefaultIdLevel = { -1 };  // same; only changed by _logger_update_default_id_level()
+
+// held while g_nCloggerDefaultIdLevel is worked out so two changes can't race
+static pthread_mutex_t g_DefaultIdLevelLock = PTHREAD_MUTEX_INITIALIZER;
 
 // private function declarations
-static int _logger_add_message(t_loggermsg* msg);
 static int _logger_log_msg(
     int log_level,
     logger_id id,
+    const char* file,
+    int line,
+    const char* func,
     char* format,
     char* msg,
     va_list arg_list
 );
-static int _logger_read_message();
+static int _logger_get_buffer();
+static void _logger_create_thread_key();
+static void _logger_retire_thread_buffer(void* p_pValue);
+static t_loggerrec* _logger_reserve_message(int p_nBufRef, int log_level, size_t p_nDataLen);
+static void _logger_release_dropped(const t_loggerrec* p_pRec);
+static int _logger_read_batch(bool p_bExit);
+static int _logger_grow_render_buf(size_t p_nSize);
+static int _logger_render_message(const char* p_sFormat, const char* p_pArgs, size_t p_nArgsLen, size_t p_nOffset);
 static void *_logger_run(void *p_pData);
 static int _logger_timedwait(sem_t *p_pSem, int t_nWaitTimeSecs);
+static void _logger_update_default_id_level();
 
 // private function definitions
-int _logger_add_message(t_loggermsg* msg) {
-
-    if (!g_logInit) {
-        lgu_warn_msg("Dropping message because logger isn't running.");
-        free(msg);
-        return 1;
-    }
-    /*
-     * Allow messages to be added to the buffer when there are no
-     * handlers IF the logger has been initialized (above).
-     */
-
-    if (lgb_add_message(buf_refid, msg)) {
-        lgu_warn_msg("Logger failed to add message to buffer.");
-        return 1;
-    }
-
-    return 0;
-
-}
-
 int _logger_log_msg(
     int log_level,
     logger_id id,
+    const char* file,
+    int line,
+    const char* func,
     __attribute__((unused))char* format,
     char* msg,
     va_list arg_list
@@ -77,12 +131,19 @@ int _logger_log_msg(
 
     // TODO implement format parameter
 
+    // check the ID's level and handlers before doing any work; an ID that doesn't exist is caught below
+    int t_nLevel = LOGGER_ID_LEVEL_GLOBAL;
+    unsigned int t_nHandlers = CLOGGER_ALL_HANDLERS;
+    lgi_get_route(id, &t_nLevel, &t_nHandlers);
+    if (t_nLevel == LOGGER_ID_LEVEL_GLOBAL)
+        t_nLevel = __atomic_load_n(&g_nCloggerLogLevel, __ATOMIC_RELAXED);
+
     // Check the level
     if (log_level < 0) {
         lgu_warn_msg("Log level must be at least zero");
         return 1;
     }
-    else if (log_level > g_nLogLevel) {
+    else if ((log_level > t_nLevel) || (t_nHandlers == 0)) {
         // This message won't be logged based on the log level
         return 0; // return 0 because no error occurred
     }
@@ -90,40 +151,16 @@ int _logger_log_msg(
         lgu_warn_msg("Can't add message; logger isn't running.");
         return 1;
     }
-
-    t_loggermsg* t_sFinalMessage = (t_loggermsg*) malloc(sizeof(t_loggermsg));
-    va_list arg_list_copy;
-    va_copy(arg_list_copy, arg_list);
-    int format_rtn = vsnprintf(t_sFinalMessage->m_sMsg, CLOGGER_MAX_MESSAGE_SIZE, msg, arg_list_copy);
-    va_end(arg_list_copy);
-    if ((format_rtn >= CLOGGER_MAX_MESSAGE_SIZE) || (format_rtn < 0)) {
-        lgu_warn_msg("Failed to format the message before adding it to the buffer.");
-        free(t_sFinalMessage);
-        return 1;
-    }
-    t_sFinalMessage->m_nLogLevel = log_level;
-    t_sFinalMessage->m_nId = id;
-    t_sFinalMessage->m_sFormat = NULL;
-
     /*
-     * TODO
-     * We currently have to get the logger_id here in case it's removed before the logging
-     * thread gets to the message on the buffer. This isn't ideal because we must obtain locks
-     * to get the value. Instead each logger_id should have its own lock(s) that can be used
-     * to indicate when it currently has an associated message on a buffer, and we will
-     * simply increment a lock here to indicate it can't be removed.
+     * Allow messages to be added to the buffer when there are no
+     * handlers IF the logger has been initialized (above).
      */
-    char t_sId[CLOGGER_ID_MAX_LEN];
-    if (lgi_get_id(t_sFinalMessage->m_nId, t_sId) != 0) {
-        lgu_warn_msg("Failed to convert ID from reference to string.");
-        free(t_sFinalMessage);
-        return 1;
-    }
-    int copy_rtn = snprintf(t_sFinalMessage->m_sId, CLOGGER_ID_MAX_LEN * (sizeof(char)), "%s", t_sId);
-    if ((copy_rtn >= CLOGGER_ID_MAX_LEN) || (copy_rtn < 0)) {
-        lgu_warn_msg("Failed to set the logger ID in the message.");
-        free(t_sFinalMessage);
-        return 1;
+
+    // don't format a message none of the ID's handlers would write
+    unsigned int t_nLive = lgh_get_handler_mask();
+    if ((t_nLive != 0) && ((t_nHandlers & t_nLive) == 0)) {
+        lgh_add_unrouted(1);
+        return 0;
     }
 
     /*
@@ -133,74 +170,448 @@ int _logger_log_msg(
      * Right now we assume at least one handler requires a timestamp.
      */
 
+    // only read the clock here; the logger thread converts it to a date
+    uint64_t t_nTimestamp = 0;
     if (g_bTimestampEnabled) {
-        time_t t_Time = time(NULL);
-        struct tm t_TimeData;
-        struct tm *t_pResult = localtime_r(&t_Time, &t_TimeData);
-        if (t_pResult != &t_TimeData) {
+        struct timespec t_tsNow;
+        if (clock_gettime(CLOCK_REALTIME, &t_tsNow) == -1) {
             lgu_warn_msg("logger failed to get the time.");
-            free(t_sFinalMessage);
             return 1;
         }
-        t_sFinalMessage->m_tmTime = t_TimeData;
+        t_nTimestamp = ((uint64_t) t_tsNow.tv_sec * 1000000000) + (uint64_t) t_tsNow.tv_nsec;
     }
 
-    return (_logger_add_message(t_sFinalMessage));
-}
+    if (g_nThreadId == 0)
+        g_nThreadId = (int) syscall(SYS_gettid);
 
-int _logger_read_message() {
+    /*
+     * Build the message's data on the stack first so we know how much space
+     * to claim on the buffer. Only text longer than CLOGGER_MAX_MESSAGE_SIZE
+     * is formatted a second time, directly into the buffer.
+     */
+    char t_sData[CLOGGER_MAX_MESSAGE_SIZE];
+    int t_nDataLen = -1;
+    int t_nMsgLen = 0;
+    const char* t_sMsgFormat = NULL;
+
+    if (atomic_load_explicit(&g_bDeferFormat, memory_order_relaxed)) {
+        // copy the arguments and let the logger thread format the message
+        va_list arg_list_copy;
+        va_copy(arg_list_copy, arg_list);
+        t_nDataLen = lga_encode(t_sData, CLOGGER_MAX_MESSAGE_SIZE, msg, arg_list_copy);
+        va_end(arg_list_copy);
+        if (t_nDataLen >= 0)
+            t_sMsgFormat = msg;
+    }
 
-    if(!g_logInit)
+    // format the message now if it wasn't deferred
+    if (t_sMsgFormat == NULL) {
+        va_list arg_list_copy;
+        va_copy(arg_list_copy, arg_list);
+        t_nMsgLen = vsnprintf(t_sData, CLOGGER_MAX_MESSAGE_SIZE, msg, arg_list_copy);
+        va_end(arg_list_copy);
+        if (t_nMsgLen < 0) {
+            lgu_warn_msg("Failed to format the message before adding it to the buffer.");
+            return 1;
+        }
+        t_nDataLen = t_nMsgLen + 1;
+    }
+
+    // keep the ID from being replaced until the logger thread has written the message
+    if (lgi_hold_id(id)) {
+        lgu_warn_msg("Can't log a message with an ID that doesn't exist.");
         return 1;
-    else if (lgh_get_num_handlers() < 1)
+    }
+
+    // claim space on the buffer and copy the message into it; where it was logged goes first, when it's known
+    size_t t_nSrcLen = (file != NULL ? sizeof(t_loggersrc) : 0);
+    int t_nBufRef = _logger_get_buffer();
+    t_loggerrec* t_sFinalMessage = _logger_reserve_message(t_nBufRef, log_level, t_nSrcLen + t_nDataLen);
+    if (t_sFinalMessage == NULL) {
+        lgu_warn_msg("Logger failed to add message to buffer.");
+        lgi_release_id(id);
         return 1;
+    }
+
+    char* t_pPayload = t_sFinalMessage->m_pData + t_nSrcLen;
+    if (t_nDataLen <= CLOGGER_MAX_MESSAGE_SIZE) {
+        memcpy(t_pPayload, t_sData, t_nDataLen);
+    }
+    else {
+        va_list arg_list_copy;
+        va_copy(arg_list_copy, arg_list);
+        int format_rtn = vsnprintf(t_pPayload, t_nDataLen, msg, arg_list_copy);
+        va_end(arg_list_copy);
+        if (format_rtn != t_nMsgLen) {
+            lgu_warn_msg("Failed to format the message before adding it to the buffer.");
+            lgb_discard_message(t_nBufRef, t_sFinalMessage);
+            lgi_release_id(id);
+            return 1;
+        }
+    }
+
+    t_sFinalMessage->m_nFlags = 0;
+    if (file != NULL) {
+        t_loggersrc t_Src = { file, func };
+        memcpy(t_sFinalMessage->m_pData, &t_Src, sizeof(t_loggersrc));
+        t_sFinalMessage->m_nFlags |= LOGGER_REC_HAS_SOURCE;
+    }
+    t_sFinalMessage->m_sMsgFormat = t_sMsgFormat;
+    t_sFinalMessage->m_nTimestamp = t_nTimestamp;
+    t_sFinalMessage->m_nDataLen = (uint32_t) (t_nSrcLen + t_nDataLen);
+    t_sFinalMessage->m_nId = id;
+    t_sFinalMessage->m_nHandlers = t_nHandlers;
+    t_sFinalMessage->m_nThreadId = g_nThreadId;
+    t_sFinalMessage->m_nLine = line;
+    t_sFinalMessage->m_nLogLevel = (uint16_t) log_level;
 
-    // Get the message at the current index
-    t_loggermsg* t_pMsg = lgb_read_message(buf_refid);
-    if (t_pMsg == NULL) {
-        lgu_warn_msg("Failed to read a message from the buffer.");
+    if (lgb_commit_message(t_nBufRef, t_sFinalMessage)) {
+        lgu_warn_msg("Logger failed to add message to buffer.");
+        lgi_release_id(id);
         return 1;
     }
 
-    // get the format string
-    char formatted_string[50]; // FIXME size
-    if (lgf_format(g_lgformatter, formatted_string, &t_pMsg->m_tmTime, t_pMsg->m_nLogLevel)) {
-        lgu_warn_msg("Failed to get the format for the message.");
-        free(t_pMsg);
+    return 0;
+}
+
+/*
+ * Returns the buffer the calling thread should add messages to: its own when
+ * thread buffers are enabled (creating it the first time), otherwise, or if
+ * it can't have one, the logger's.
+ */
+int _logger_get_buffer() {
+
+    if (g_nThreadBufferBytes == 0)
+        return buf_refid;
+
+    unsigned int t_nInitCount = atomic_load_explicit(&g_nInitCount, memory_order_relaxed);
+    if (g_nThreadBufInit != t_nInitCount) {
+        // only try once per run; a thread that can't get a buffer shares the logger's
+        g_nThreadBufInit = t_nInitCount;
+        g_nThreadBufRef = lgb_create_thread_buffer(buf_refid);
+        if (g_nThreadBufRef >= 0) {
+            pthread_once(&g_ThreadKeyOnce, &_logger_create_thread_key);
+            uintptr_t t_nValue = ((uintptr_t) t_nInitCount << 16) | (uintptr_t) (g_nThreadBufRef + 1);
+            pthread_setspecific(g_ThreadKey, (void*) t_nValue);
+        }
+    }
+
+    return (g_nThreadBufRef >= 0 ? g_nThreadBufRef : buf_refid);
+}
+
+/*
+ * Works out g_nCloggerDefaultIdLevel again after the logger's level, or the
+ * default ID's level or handlers, change.
+ */
+void _logger_update_default_id_level() {
+    pthread_mutex_lock(&g_DefaultIdLevelLock);
+
+    int t_nLevel = LOGGER_ID_LEVEL_GLOBAL;
+    unsigned int t_nHandlers = CLOGGER_ALL_HANDLERS;
+    if (!g_logInit || lgi_get_route(CLOGGER_DEFAULT_ID, &t_nLevel, &t_nHandlers) || (t_nHandlers == 0))
+        t_nLevel = -1;
+    else if (t_nLevel == LOGGER_ID_LEVEL_GLOBAL)
+        t_nLevel = __atomic_load_n(&g_nCloggerLogLevel, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_nCloggerDefaultIdLevel, t_nLevel, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&g_DefaultIdLevelLock);
+}
+
+void _logger_create_thread_key() {
+    if (pthread_key_create(&g_ThreadKey, &_logger_retire_thread_buffer))
+        lgu_warn_msg("Failed to create the key used to remove thread buffers.");
+}
+
+/*
+ * Called when a thread with its own buffer exits. p_pValue holds the run the
+ * buffer belongs to and its reference plus one.
+ */
+void _logger_retire_thread_buffer(void* p_pValue) {
+    uintptr_t t_nValue = (uintptr_t) p_pValue;
+    unsigned int t_nInitCount = (unsigned int) (t_nValue >> 16);
+    int t_nBufRef = (int) (t_nValue & 0xFFFF) - 1;
+
+    pthread_mutex_lock(&g_ThreadBufLock);
+    unsigned int t_nCurrent = atomic_load(&g_nInitCount) & (unsigned int) (UINTPTR_MAX >> 16);
+    if (g_bBuffersLive && (t_nInitCount == t_nCurrent))
+        lgb_retire_buffer(t_nBufRef);
+    pthread_mutex_unlock(&g_ThreadBufLock);
+}
+
+/*
+ * Claims space on the buffer for a message, following the overflow policy
+ * when the buffer is full. Every message that isn't logged, or is removed to
+ * make room, is counted for logger_get_stats().
+ *
+ * Returns NULL if the message can't be added.
+ */
+t_loggerrec* _logger_reserve_message(int p_nBufRef, int log_level, size_t p_nDataLen) {
+
+    // no amount of waiting or dropping makes room for a message this large
+    if (p_nDataLen > lgb_get_max_data(p_nBufRef)) {
+        lgu_warn_msg("The message is too large for the buffer.");
+        atomic_fetch_add_explicit(&g_nDropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    int t_nPolicy = atomic_load_explicit(&g_nOverflowPolicy, memory_order_relaxed);
+    int t_nValue = atomic_load_explicit(&g_nOverflowValue, memory_order_relaxed);
+
+    // shed verbose messages early, so the space left goes to the important ones
+    if ((t_nPolicy == CLOGGER_OVERFLOW_DROP_BELOW_LEVEL) && (log_level > t_nValue)) {
+        if (lgb_get_fill(p_nBufRef) >= g_nShedPercent) {
+            atomic_fetch_add_explicit(&g_nShed, 1, memory_order_relaxed);
+            return NULL;
+        }
+    }
+
+    t_loggerrec* t_pMsg = lgb_reserve_message(p_nBufRef, p_nDataLen);
+    if (t_pMsg != NULL)
+        return t_pMsg;
+
+    if (t_nPolicy == CLOGGER_OVERFLOW_BLOCK) {
+        struct timespec t_tsBreak;
+        if (clock_gettime(CLOCK_REALTIME, &t_tsBreak) == -1) {
+            lgu_warn_msg("logger failed to get the time.");
+            atomic_fetch_add_explicit(&g_nDropped, 1, memory_order_relaxed);
+            return NULL;
+        }
+        lgb_add_to_time(&t_tsBreak, t_nValue, 0, INT_MAX);
+
+        while (t_pMsg == NULL) {
+            int t_nWaitRtn = lgb_wait_for_space(p_nBufRef, p_nDataLen, &t_tsBreak);
+            t_pMsg = lgb_reserve_message(p_nBufRef, p_nDataLen);
+            if ((t_pMsg == NULL) && (t_nWaitRtn != 0)) {
+                atomic_fetch_add_explicit((t_nWaitRtn > 0 ? &g_nTimedOut : &g_nDropped), 1, memory_order_relaxed);
+                return NULL;
+            }
+        }
+        return t_pMsg;
+    }
+    else if (t_nPolicy == CLOGGER_OVERFLOW_OVERWRITE_OLDEST) {
+        while (t_pMsg == NULL) {
+            int t_nDropped = lgb_drop_oldest(p_nBufRef, LOGGER_OVERWRITE_WAIT_MS, &_logger_release_dropped);
+            if (t_nDropped > 0)
+                atomic_fetch_add_explicit(&g_nOverwritten, t_nDropped, memory_order_relaxed);
+
+            t_pMsg = lgb_reserve_message(p_nBufRef, p_nDataLen);
+            if ((t_pMsg == NULL) && (t_nDropped <= 0)) {
+                // nothing left that can be removed; give up on the new message instead
+                atomic_fetch_add_explicit(&g_nDropped, 1, memory_order_relaxed);
+                return NULL;
+            }
+        }
+        return t_pMsg;
+    }
+
+    atomic_fetch_add_explicit(&g_nDropped, 1, memory_order_relaxed);
+    return NULL;
+}
+
+// lets a message's ID be reused once the message is overwritten
+void _logger_release_dropped(const t_loggerrec* p_pRec) {
+    lgi_release_id(p_pRec->m_nId);
+}
+
+/*
+ * Makes the render buffer at least p_nSize bytes. The buffer can move.
+ *
+ * Returns 0 on success.
+ */
+int _logger_grow_render_buf(size_t p_nSize) {
+    if (p_nSize <= g_nRenderBufSize)
+        return 0;
+
+    size_t t_nNewSize = (g_nRenderBufSize * 2 > p_nSize ? g_nRenderBufSize * 2 : p_nSize);
+    char* t_sNewBuf = (char*) realloc(g_sRenderBuf, t_nNewSize);
+    if (t_sNewBuf == NULL) {
+        lgu_warn_msg("Failed to allocate space to format a message.");
         return 1;
     }
-    t_pMsg->m_sFormat = formatted_string;
+    g_sRenderBuf = t_sNewBuf;
+    g_nRenderBufSize = t_nNewSize;
+    return 0;
+}
+
+/*
+ * Formats a deferred message at p_nOffset in the render buffer, growing the
+ * buffer as needed. The buffer can move, so m_sMsg is set by the caller once
+ * the whole batch has been rendered.
+ *
+ * Returns the length of the message, which uses one more byte than that in
+ * the render buffer, or -1 on error.
+ */
+int _logger_render_message(const char* p_sFormat, const char* p_pArgs, size_t p_nArgsLen, size_t p_nOffset) {
+
+    while (true) {
+        int t_nRendered = -1;
+        if ((g_sRenderBuf != NULL) && (p_nOffset < g_nRenderBufSize)) {
+            t_nRendered = lga_render(
+                g_sRenderBuf + p_nOffset,
+                g_nRenderBufSize - p_nOffset,
+                p_sFormat,
+                p_pArgs,
+                p_nArgsLen
+            );
+            if (t_nRendered < 0)
+                return -1;
+            else if ((size_t) t_nRendered < (g_nRenderBufSize - p_nOffset))
+                return t_nRendered;
+        }
+
+        // the message didn't fit; make room for it and try again
+        size_t t_nNeeded = p_nOffset + (t_nRendered > CLOGGER_MAX_MESSAGE_SIZE ? (size_t) t_nRendered + 1 : CLOGGER_MAX_MESSAGE_SIZE);
+        if (_logger_grow_render_buf(t_nNeeded))
+            return -1;
+    }
+}
+
+/*
+ * Takes every message that's ready (up to LOGGER_BATCH_SIZE) off the buffer,
+ * copies what the handlers need, gives the space back to the buffer in one
+ * step, then writes them. Producers never wait on a slow handler to drop the
+ * oldest messages or get space back.
+ *
+ * Messages are left on the buffer while there are no handlers to write them
+ * to, unless the logger is exiting.
+ *
+ * Returns the number of messages read, or -1 on error.
+ */
+int _logger_read_batch(bool p_bExit) {
+
+    if(!g_logInit)
+        return -1;
+    else if ((lgh_get_num_handlers() < 1) && !p_bExit)
+        return 0;
+
+    t_loggerrec* t_pRecs[LOGGER_BATCH_SIZE];
+    int t_nCount = lgb_read_batch(buf_refid, t_pRecs, LOGGER_BATCH_SIZE);
+    if (t_nCount < 0) {
+        lgu_warn_msg("Failed to read messages from the buffer.");
+        return -1;
+    }
 
     /*
-     * TODO
-     * We should get the value of the logger_id here, but it could lead to an ID being
-     * removed before the logging thread retrieves its value. Locks should be added to
-     * each ID to indicate when it's currently waiting to be used. When those are in place,
-     * we can can get the value of the ID here, and free its lock when done.
+     * Get every message in the batch ready before writing any of them, so
+     * handlers can write the whole batch at once. The records only hold what
+     * the threads that logged them knew; the rest of what handlers need is
+     * kept here. Messages that can't be formatted are left out.
      */
+    t_loggermsg t_Msgs[LOGGER_BATCH_SIZE];
+    const t_loggermsg* t_pReady[LOGGER_BATCH_SIZE];
+    char t_sDates[LOGGER_BATCH_SIZE][FORMATTER_DATE_SIZE];
+    size_t t_nRenderOffsets[LOGGER_BATCH_SIZE];
+    size_t t_nRenderUsed = 0;
+    int t_nReady = 0;
+
+    for (int count = 0; count < t_nCount; count++) {
+        const t_loggerrec* t_pRec = t_pRecs[count];
+        t_loggermsg* t_pMsg = &t_Msgs[count];
+        t_pMsg->m_nId = t_pRec->m_nId;
+        t_nRenderOffsets[count] = SIZE_MAX;
+
+        const char* t_pPayload = t_pRec->m_pData;
+        size_t t_nPayloadLen = t_pRec->m_nDataLen;
+        t_pMsg->m_sFile = NULL;
+        t_pMsg->m_sFunc = NULL;
+        if (t_pRec->m_nFlags & LOGGER_REC_HAS_SOURCE) {
+            t_loggersrc t_Src;
+            memcpy(&t_Src, t_pPayload, sizeof(t_loggersrc));
+            t_pMsg->m_sFile = t_Src.m_sFile;
+            t_pMsg->m_sFunc = t_Src.m_sFunc;
+            t_pPayload += sizeof(t_loggersrc);
+            t_nPayloadLen -= sizeof(t_loggersrc);
+        }
+
+        // format the message if the thread that logged it deferred the work to us
+        if (t_pRec->m_sMsgFormat != NULL) {
+            int t_nMsgLen = _logger_render_message(t_pRec->m_sMsgFormat, t_pPayload, t_nPayloadLen, t_nRenderUsed);
+            if (t_nMsgLen < 0) {
+                lgu_warn_msg("Failed to format a deferred message.");
+                continue;
+            }
+            t_nRenderOffsets[count] = t_nRenderUsed;
+            t_nRenderUsed += (size_t) t_nMsgLen + 1;
+            t_pMsg->m_nMsgLen = t_nMsgLen;
+        }
+        else {
+            if (_logger_grow_render_buf(t_nRenderUsed + t_nPayloadLen))
+                continue;
+            memcpy(g_sRenderBuf + t_nRenderUsed, t_pPayload, t_nPayloadLen);
+            t_nRenderOffsets[count] = t_nRenderUsed;
+            t_nRenderUsed += t_nPayloadLen;
+            t_pMsg->m_nMsgLen = (int) t_nPayloadLen - 1;
+        }
+
+        if (lgl_check(t_pRec->m_nLogLevel)) {
+            lgu_warn_msg_int("Log level has invalid range; value: %d", t_pRec->m_nLogLevel);
+            continue;
+        }
+
+        // the handlers lay out the rest of the line themselves
+        int t_nDateLen = lgf_format(g_lgformatter, t_sDates[count], t_pRec->m_nTimestamp);
+        if (t_nDateLen < 0) {
+            lgu_warn_msg("Failed to get the date for the message.");
+            continue;
+        }
+        t_pMsg->m_nLogLevel = t_pRec->m_nLogLevel;
+        t_pMsg->m_nHandlers = t_pRec->m_nHandlers;
+        t_pMsg->m_sDate = t_sDates[count];
+        t_pMsg->m_nDateLen = t_nDateLen;
+        t_pMsg->m_sId = lgi_peek_id(t_pRec->m_nId, &t_pMsg->m_nIdLen);
+        t_pMsg->m_nTimestamp = t_pRec->m_nTimestamp;
+        t_pMsg->m_nLine = t_pRec->m_nLine;
+        t_pMsg->m_nThreadId = t_pRec->m_nThreadId;
+
+        t_pReady[t_nReady++] = t_pMsg;
+    }
+
+    // the render buffer is done moving; point the messages at their text
+    for (int count = 0; count < t_nCount; count++) {
+        if (t_nRenderOffsets[count] != SIZE_MAX)
+            t_Msgs[count].m_sMsg = g_sRenderBuf + t_nRenderOffsets[count];
+    }
 
-    // TODO attach handlers to logger_id, and write to handlers based on the id used
-    if (lgh_write_to_all(t_pMsg)) {
-        // we either failed to write to one or more handlers, or there were no open
-        // handlers to write to
+    // nothing the handlers use is on the buffer anymore
+    lgb_release_batch(buf_refid);
+
+    // each handler is only given the messages whose ID writes to it
+    if ((t_nReady > 0) && lgh_write_batch_to_all(t_pReady, t_nReady)) {
+        // one or more handlers failed to write, or weren't open
         lgu_warn_msg("logger thread failed to write to a handler");
     }
-    free(t_pMsg);                   // free the memory
 
-    return 0;
+    // the handlers are done with the IDs' text
+    for (int count = 0; count < t_nCount; count++)
+        lgi_release_id(t_Msgs[count].m_nId);
+
+    return t_nCount;
 }
 
 void *_logger_run(__attribute__((unused))void *p_pData) {
 
     bool t_bExit = false;
+    bool t_bHandlersWaiting = false; // a handler is holding messages to write later
+    bool t_bHandlersClosed = false; // a handler failed to open and will be tried again
     int t_nCurrentHandlers = 0;
     while(true) {
 
-        short t_nMessagesBeforeCheck = 25;  // TODO This value should probably be less than the buffer size
-        short t_nMessagesRead = 0;
+        // try again to open handlers that failed to, about once per pass
+        bool t_bRetryOpen = t_bHandlersClosed;
+
+        int t_nMessagesBeforeCheck = 25 * LOGGER_BATCH_SIZE;
+        int t_nMessagesRead = 0;
 
-        while(t_nMessagesRead < t_nMessagesBeforeCheck) {
-            int wait_rtn = lgb_wait_for_messages(buf_refid, 1); // FIXME need to make this variable
+        // when exiting, keep reading until the buffer is empty
+        while(t_bExit || (t_nMessagesRead < t_nMessagesBeforeCheck)) {
+            // once we're exiting, only drain what's already on the buffer
+            int t_nWaitMs = LOGGER_SLEEP_SECS * 1000;
+            if (t_bExit)
+                t_nWaitMs = 1;
+            else if (t_bHandlersWaiting)
+                t_nWaitMs = LOGGER_FLUSH_CHECK_MS;
+
+            int wait_rtn = lgb_wait_for_messages(buf_refid, t_nWaitMs);
 
             int t_nNewHandlerCount = lgh_get_num_handlers();
             if (t_nNewHandlerCount < 0) {
@@ -209,24 +620,34 @@ void *_logger_run(__attribute__((unused))void *p_pData) {
                 return NULL;
             }
 
-            if (t_nNewHandlerCount != t_nCurrentHandlers) {
-                // handler(s) to open
-                if (lgh_open_handlers()) {
-                    // failed to open a handler
-                    lgu_warn_msg("Logger thread failed to open a handler.");
-                    // FIXME error handle
-                    return NULL;
-                }
+            if ((t_nNewHandlerCount != t_nCurrentHandlers) || t_bRetryOpen) {
+                // handler(s) to open; messages for one that won't open are dropped and counted
+                t_bHandlersClosed = (lgh_open_handlers() != 0);
+                if (t_bHandlersClosed && !t_bRetryOpen)
+                    lgu_warn_msg("Logger thread failed to open a handler; it will try again.");
+                t_bRetryOpen = false;
                 t_nCurrentHandlers= lgh_get_num_handlers();
             }
 
             if (wait_rtn == 0) {
-                // there's a message to read
-                _logger_read_message();
-                t_nMessagesRead++;
+                // there's at least one message to read
+                int t_nRead = _logger_read_batch(t_bExit);
+                if (t_nRead == 0 && t_nCurrentHandlers < 1) {
+                    // nowhere to write the messages yet; don't spin on them
+                    struct timespec t_Pause = { 0, LOGGER_NO_HANDLER_PAUSE_MS * 1000000 };
+                    nanosleep(&t_Pause, NULL);
+                    break;
+                }
+                else if (t_nRead > 0) {
+                    t_nMessagesRead += t_nRead;
+                    t_bHandlersWaiting = (lgh_flush_all(false) > 0);
+                }
             }
             else if (wait_rtn > 0) {
-                // timed out; break from the loop to check if we need to exit
+                // timed out; write anything handlers have held on to for too long
+                if (t_bHandlersWaiting)
+                    t_bHandlersWaiting = (lgh_flush_all(false) > 0);
+                // break from the loop to check if we need to exit
                 break;
             }
             else if (wait_rtn < 0) {
@@ -302,6 +723,11 @@ __attribute__((unused))int _logger_timedwait(sem_t *p_pSem, int milliseconds_to_
 
 // public functions
 int logger_init(int p_nLogLevel) {
+    logger_options t_options = { p_nLogLevel, 0, 0, 0, 0 };
+    return logger_init_with_options(&t_options);
+}
+
+int logger_init_with_options(const logger_options* p_pOptions) {
 
 #ifndef NDEBUG
 #ifndef CLOGGER_REMOVE_WARNING
@@ -318,6 +744,14 @@ int logger_init(int p_nLogLevel) {
         lgu_warn_msg("The amount of time the logger should sleep must be an integer greater than zero");
         return 1;
     }
+    else if (p_pOptions == NULL) {
+        lgu_warn_msg("The logger options can't be NULL.");
+        return 1;
+    }
+    else if ((p_pOptions->shed_percent < 0) || (p_pOptions->shed_percent > 100)) {
+        lgu_warn_msg_int("The fill level to shed messages at must be a percentage; got %d", p_pOptions->shed_percent);
+        return 1;
+    }
 
     if (lgi_init() != 0) {
         lgu_warn_msg("Failed to initialize the logger IDs.");
@@ -349,23 +783,30 @@ int logger_init(int p_nLogLevel) {
     }
 
     // Set the log level based on what the user specified
-    if (p_nLogLevel < 0) {
+    if (p_pOptions->log_level < 0) {
         lgu_warn_msg("The log level must be at least zero.");
         return 1;
     }
-    g_nLogLevel = p_nLogLevel;
+    __atomic_store_n(&g_nCloggerLogLevel, p_pOptions->log_level, __ATOMIC_RELAXED);
+    g_nShedPercent = (p_pOptions->shed_percent > 0 ? p_pOptions->shed_percent : LOGGER_SHED_FILL_PERCENT);
 
     // TODO make sure this value is >= 0 before changing it?
-    buf_refid = lgb_init();
+    buf_refid = lgb_init(p_pOptions->buffer_bytes, p_pOptions->reserve_bytes, p_pOptions->thread_buffer_bytes);
     if (buf_refid < 0) {
         lgu_warn_msg("Failed to create the log buffer.");
         return 1;
     }
 
+    g_nThreadBufferBytes = p_pOptions->thread_buffer_bytes;
+    pthread_mutex_lock(&g_ThreadBufLock);
+    atomic_fetch_add(&g_nInitCount, 1);
+    g_bBuffersLive = true;
+    pthread_mutex_unlock(&g_ThreadBufLock);
     g_bExit = false;
 
     // Start the log thread
     g_logInit = true;
+    _logger_update_default_id_level();
     pthread_create(&g_LogThread, NULL, _logger_run, NULL);
 
 #ifndef NDEBUG
@@ -386,6 +827,7 @@ int logger_free() {
 
     // Tell the logging thread it's time to end
     g_bExit = true;
+    lgb_wake(buf_refid);
 
     bool* join_val = NULL;
     pthread_join(g_LogThread, (void**) &join_val);
@@ -403,6 +845,20 @@ int logger_free() {
     }
 
     g_logInit = false;
+    __atomic_store_n(&g_nCloggerLogLevel, -1, __ATOMIC_RELAXED);
+    _logger_update_default_id_level();
+
+    // free the handler memory; this stops any handler threads, which read from
+    // their own buffers, so it has to happen before the buffers are freed
+    if (lgh_free()) {
+        t_nRtn = 1;
+    }
+
+    // threads exiting from here on leave their buffers alone
+    pthread_mutex_lock(&g_ThreadBufLock);
+    g_bBuffersLive = false;
+    pthread_mutex_unlock(&g_ThreadBufLock);
+
     if (lgb_free()) {
         lgu_warn_msg("Failed to free the log buffer.");
         fflush(stderr);
@@ -410,11 +866,6 @@ int logger_free() {
     }
     buf_refid = -1;
 
-    // free the handler memory
-    if (lgh_free()) {
-        t_nRtn = 1;
-    }
-
     // free the formatters
     // FIXME semaphore(s) to modify values
     // TODO currently nothing to close(), but might change
@@ -422,6 +873,10 @@ int logger_free() {
     free(g_lgformatter);
     g_lgformatter = NULL;
 
+    free(g_sRenderBuf);
+    g_sRenderBuf = NULL;
+    g_nRenderBufSize = 0;
+
     if (lgi_free() != 0) {
         lgu_warn_msg("Failed to free the logger IDs.");
         t_nRtn = 1;
@@ -479,12 +934,101 @@ int logger_is_running() {
     else return 0;
 }
 
+int logger_level_enabled(int p_nLogLevel) {
+    if ((p_nLogLevel < 0) || !CLOGGER_LEVEL_ENABLED(p_nLogLevel) || !g_logInit) {
+        return 0;
+    }
+    return 1;
+}
+
+int logger_set_level(int p_nLogLevel) {
+    if (!g_logInit) {
+        lgu_warn_msg("Can't set the log level; logger isn't running.");
+        return 1;
+    }
+    else if (p_nLogLevel < 0) {
+        lgu_warn_msg("The log level must be at least zero.");
+        return 1;
+    }
+    __atomic_store_n(&g_nCloggerLogLevel, p_nLogLevel, __ATOMIC_RELAXED);
+    _logger_update_default_id_level();
+    return 0;
+}
+
+int logger_get_level() {
+    return __atomic_load_n(&g_nCloggerLogLevel, __ATOMIC_RELAXED);
+}
+
+int logger_id_level_enabled(logger_id id_ref, int p_nLogLevel) {
+    int t_nLevel;
+    unsigned int t_nHandlers;
+    if ((p_nLogLevel < 0) || !g_logInit || lgi_get_route(id_ref, &t_nLevel, &t_nHandlers)) {
+        return 0;
+    }
+    if (t_nLevel == LOGGER_ID_LEVEL_GLOBAL)
+        t_nLevel = __atomic_load_n(&g_nCloggerLogLevel, __ATOMIC_RELAXED);
+    if ((p_nLogLevel > t_nLevel) || (t_nHandlers == 0)) {
+        return 0;
+    }
+    return 1;
+}
+
+int logger_set_time_precision(int p_nDigits) {
+    if (!g_logInit) {
+        lgu_warn_msg("Can't set the time precision; logger isn't running.");
+        return 1;
+    }
+    return lgf_set_time_precision(g_lgformatter, p_nDigits);
+}
+
+int logger_set_deferred_format(int p_bEnabled) {
+    atomic_store(&g_bDeferFormat, (p_bEnabled != 0));
+    return 0;
+}
+
+int logger_set_overflow_policy(int p_nPolicy, int p_nValue) {
+    if ((p_nPolicy < CLOGGER_OVERFLOW_DROP_NEWEST) || (p_nPolicy > CLOGGER_OVERFLOW_DROP_BELOW_LEVEL)) {
+        lgu_warn_msg_int("Unknown overflow policy: %d", p_nPolicy);
+        return 1;
+    }
+    else if ((p_nPolicy == CLOGGER_OVERFLOW_BLOCK) && (p_nValue < 0)) {
+        lgu_warn_msg("The time to wait for space can't be negative.");
+        return 1;
+    }
+    else if ((p_nPolicy == CLOGGER_OVERFLOW_DROP_BELOW_LEVEL) && ((p_nValue < 0) || (p_nValue > LOGGER_MAX_LEVEL))) {
+        lgu_warn_msg_int("Invalid level to keep when the buffer is full: %d", p_nValue);
+        return 1;
+    }
+
+    atomic_store(&g_nOverflowValue, p_nValue);
+    atomic_store(&g_nOverflowPolicy, p_nPolicy);
+    return 0;
+}
+
+int logger_get_stats(logger_stats* p_pStats) {
+    if (p_pStats == NULL) {
+        lgu_warn_msg("Can't get the logger stats; no place to put them.");
+        return 1;
+    }
+
+    p_pStats->dropped = atomic_load_explicit(&g_nDropped, memory_order_relaxed);
+    p_pStats->overwritten = atomic_load_explicit(&g_nOverwritten, memory_order_relaxed);
+    p_pStats->shed = atomic_load_explicit(&g_nShed, memory_order_relaxed);
+    p_pStats->timed_out = atomic_load_explicit(&g_nTimedOut, memory_order_relaxed);
+    p_pStats->handler_dropped = lgh_get_dropped();
+    p_pStats->unrouted = lgh_get_unrouted();
+    return 0;
+}
+
 int logger_log_msg(int p_nLogLevel, char* msg, ...) {
     va_list arg_list;
     va_start(arg_list, msg);
     int rtn_val = _logger_log_msg(
         p_nLogLevel,
         0,   // ID
+        NULL,   // file
+        0,      // line
+        NULL,   // function
         NULL,   // format
         msg,
         arg_list
@@ -501,6 +1045,28 @@ int logger_log_msg_id(int p_nLogLevel, logger_id log_id, char* msg, ...) {
     int rtn_val = _logger_log_msg(
         p_nLogLevel,
         log_id,   // ID
+        NULL,   // file
+        0,      // line
+        NULL,   // function
+        NULL,   // format
+        msg,
+        arg_list
+    );
+    va_end(arg_list);
+
+    return rtn_val;
+}
+
+int logger_log_msg_at(int p_nLogLevel, logger_id log_id, const char* p_sFile, int p_nLine, const char* p_sFunc, char* msg, ...) {
+
+    va_list arg_list;
+    va_start(arg_list, msg);
+    int rtn_val = _logger_log_msg(
+        p_nLogLevel,
+        log_id,
+        p_sFile,
+        p_nLine,
+        p_sFunc,
         NULL,   // format
         msg,
         arg_list
@@ -511,6 +1077,11 @@ int logger_log_msg_id(int p_nLogLevel, logger_id log_id, char* msg, ...) {
 }
 
 // handler code
+int logger_set_handler_threads(int p_bEnabled) {
+    lgh_set_threaded(p_bEnabled != 0);
+    return 0;
+}
+
 int logger_create_console_handler(FILE *p_pOut) {
     log_handler tmp_handler;
     int rtnval = create_console_handler(&tmp_handler, p_pOut);
@@ -524,8 +1095,12 @@ int logger_create_console_handler(FILE *p_pOut) {
 }
 
 int logger_create_file_handler(char* p_sLogLocation, char* p_sLogName) {
+    return logger_create_file_handler_with_policy(p_sLogLocation, p_sLogName, NULL);
+}
+
+int logger_create_file_handler_with_policy(char* p_sLogLocation, char* p_sLogName, const logger_flush_policy* p_pPolicy) {
     log_handler tmp_handler;
-    int rtnval = create_file_handler(&tmp_handler, p_sLogLocation, p_sLogName);
+    int rtnval = create_file_handler(&tmp_handler, p_sLogLocation, p_sLogName, p_pPolicy);
     if (rtnval != 0) {
         return rtnval;
     }
@@ -535,6 +1110,26 @@ int logger_create_file_handler(char* p_sLogLocation, char* p_sLogName) {
     else return 1;
 }
 
+int logger_set_handler_format(int p_nHandler, int p_nFormat) {
+    if ((p_nHandler < 0) || (p_nHandler >= CLOGGER_MAX_NUM_HANDLERS)) {
+        lgu_warn_msg_int("Invalid handler: %d", p_nHandler);
+        return 1;
+    }
+    return lgh_set_format((t_handlerref) p_nHandler, p_nFormat);
+}
+
+int logger_set_handler_layout(int p_nHandler, const char* p_sPattern) {
+    if ((p_nHandler < 0) || (p_nHandler >= CLOGGER_MAX_NUM_HANDLERS)) {
+        lgu_warn_msg_int("Invalid handler: %d", p_nHandler);
+        return 1;
+    }
+    else if (p_sPattern == NULL) {
+        lgu_warn_msg("The layout pattern can't be NULL");
+        return 1;
+    }
+    return lgh_set_layout((t_handlerref) p_nHandler, p_sPattern);
+}
+
 #ifdef CLOGGER_GRAYLOG
 int logger_create_graylog_handler(char* p_sServer, int p_nPort, int p_nProtocol) {
     log_handler tmp_handler;
@@ -554,6 +1149,10 @@ logger_id logger_create_id(char* p_sID) {
     return lgi_add_id(p_sID);
 }
 
+logger_id logger_find_id(char* p_sID) {
+    return lgi_find_id(p_sID);
+}
+
 int logger_remove_id(logger_id id_ref) {
     if (id_ref == CLOGGER_DEFAULT_ID) {
         lgu_warn_msg("Can't remove the default logger_id.");
@@ -562,6 +1161,30 @@ int logger_remove_id(logger_id id_ref) {
     return lgi_remove_id(id_ref);
 }
 
+int logger_set_id_level(logger_id id_ref, int p_nLogLevel) {
+    if (p_nLogLevel < LOGGER_ID_LEVEL_GLOBAL) {
+        lgu_warn_msg_int("Invalid level for a logger ID: %d", p_nLogLevel);
+        return 1;
+    }
+    else if (lgi_set_level(id_ref, p_nLogLevel)) {
+        return 1;
+    }
+
+    // CLOG_LOG() checks the default ID's level without a function call
+    if (id_ref == CLOGGER_DEFAULT_ID)
+        _logger_update_default_id_level();
+    return 0;
+}
+
+int logger_set_id_handlers(logger_id id_ref, unsigned int p_nHandlers) {
+    if (lgi_set_handlers(id_ref, p_nHandlers))
+        return 1;
+
+    if (id_ref == CLOGGER_DEFAULT_ID)
+        _logger_update_default_id_level();
+    return 0;
+}
+
 #ifndef NDEBUG
 #include <unistd.h>
 
@@ -586,23 +1209,26 @@ bool custom_test_logger_large_add_message() {
     printf("\n");
 
 
-    int t_nBufferSize = logger_get_buffer_size();
-    int t_nWarnBuffer = logger_get_buffer_close_warn();
+    // the buffer is sized in bytes, so count how many of these messages fit
+    size_t t_nBufferSize = logger_get_buffer_size();
+    size_t t_nWarnBuffer = logger_get_buffer_close_warn();
+    size_t t_nRecordSize = logger_get_record_size(sizeof("here"));
 
     // the following must be true for the test to work
-    if ((t_nBufferSize - (t_nWarnBuffer * 2)) <= 0) {
+    if (t_nBufferSize <= (t_nWarnBuffer + (2 * t_nRecordSize))) {
         printf("Cannot conduct test with current values\n");
         return false;
     }
-    short t_nCurrentIndex = 0;
+    size_t t_nFit = (t_nBufferSize - t_nWarnBuffer) / t_nRecordSize;
 
-    // fill the buffer with (t_nBufferSize - t_nWarnBuffer) messages, and let them get read
-    while (t_nCurrentIndex < (t_nBufferSize - t_nWarnBuffer)) {
-        printf("the value of t_nCurrentIndex is: %d\n", t_nCurrentIndex);
-        if (!logger_log_msg(LOGGER_INFO, (char*) "foobar")) {
-            printf("Something went wrong before it should have\n");
+    // fill the buffer once, half at a time so the messages get read, so the next ones wrap around
+    for (int t_nHalf = 0; t_nHalf < 2; t_nHalf++) {
+        for (size_t t_nCount = 0; t_nCount < (t_nFit / 2); t_nCount++) {
+            if (logger_log_msg(LOGGER_INFO, (char*) "here")) {
+                printf("Something went wrong before it should have\n");
+            }
         }
-        t_nCurrentIndex++;
+        sleep(1);
     }
 
     // Tell the logger to stop running
@@ -611,21 +1237,13 @@ bool custom_test_logger_large_add_message() {
     }
     sleep(5);
 
-    // When the index hits this number, we shouldn't be able to add more messages
-    int t_nWarnIndex = t_nCurrentIndex - t_nWarnBuffer;
-    int t_nMessagesToAdd = t_nWarnIndex + t_nWarnBuffer;
-
-    for (short t_nCount = 0; t_nCount < t_nMessagesToAdd; t_nCount++) {
-        if (!logger_log_msg(LOGGER_INFO, (char*) "here")) {
-            printf("Failed too early\n");
-            return false;
-        }
-    }
+    // nothing reads the buffer now; padding where it wraps can cost one message
+    size_t t_nAdded = 0;
+    while ((t_nAdded <= t_nFit) && (logger_log_msg(LOGGER_INFO, (char*) "here") == 0))
+        t_nAdded++;
 
-    // Now that we have reached the warn index, the next item should return false
-    bool t_bFinalReturn = logger_log_msg(LOGGER_INFO, (char*) "fail here");
-    if (t_bFinalReturn) {
-        printf("This was supposed to be false.\n");
+    if ((t_nAdded > t_nFit) || ((t_nAdded + 1) < t_nFit)) {
+        printf("Added %zu messages; expected %zu to fit.\n", t_nAdded, t_nFit);
         return false;
     }
     else {
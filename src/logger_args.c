@@ -0,0 +1,422 @@
+
+#include "logger_args.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h> // memcpy(), strlen()
+
+#define LGA_MAX_SPEC_LEN 32
+
+typedef enum {
+    LGA_ARG_NONE,       // '%%'
+    LGA_ARG_INT,
+    LGA_ARG_UINT,
+    LGA_ARG_LLONG,
+    LGA_ARG_ULLONG,
+    LGA_ARG_DOUBLE,
+    LGA_ARG_LDOUBLE,
+    LGA_ARG_STR,
+    LGA_ARG_PTR
+} t_lgaargtype;
+
+/*
+ * A conversion specification parsed from a format string.
+ *
+ * Integer arguments are narrowed according to their length modifier when
+ * they're stored, so m_nModStart is used to rebuild the specification with
+ * the modifier that matches the stored type.
+ */
+typedef struct {
+    int             m_nLen;         // characters from '%' through the conversion
+    int             m_nModStart;    // offset of the length modifier
+    char            m_cMod;         // 0, 'H' (hh), 'h', 'l', 'q' (ll), 'j', 'z', 't', or 'L'
+    char            m_cConv;
+    bool            m_bWidthArg;
+    bool            m_bPrecArg;
+    int             m_nPrecision;   // -1 when not given in the format
+    t_lgaargtype    m_type;
+} t_lgaspec;
+
+// private function declarations
+static int _lga_parse_spec(const char* p_sSpec, t_lgaspec* p_pSpec);
+static int _lga_build_spec(char* p_sDest, const char* p_sSpec, const t_lgaspec* p_pSpec);
+
+// private function definitions
+
+/*
+ * Parses the specification starting at the '%' p_sSpec points to.
+ *
+ * Returns the length of the specification, or -1 if it can't be deferred.
+ */
+int _lga_parse_spec(const char* p_sSpec, t_lgaspec* p_pSpec) {
+
+    memset(p_pSpec, 0, sizeof(t_lgaspec));
+    p_pSpec->m_nPrecision = -1;
+
+    int t_nIndex = 1;
+    if (p_sSpec[t_nIndex] == '%') {
+        p_pSpec->m_nLen = 2;
+        p_pSpec->m_nModStart = 1;
+        p_pSpec->m_cConv = '%';
+        p_pSpec->m_type = LGA_ARG_NONE;
+        return p_pSpec->m_nLen;
+    }
+
+    // flags
+    while ((p_sSpec[t_nIndex] != '\0') && (strchr("-+ #0'", p_sSpec[t_nIndex]) != NULL))
+        t_nIndex++;
+
+    // width
+    if (p_sSpec[t_nIndex] == '*') {
+        p_pSpec->m_bWidthArg = true;
+        t_nIndex++;
+    }
+    else {
+        while ((p_sSpec[t_nIndex] >= '0') && (p_sSpec[t_nIndex] <= '9'))
+            t_nIndex++;
+    }
+
+    // positional arguments aren't supported
+    if (p_sSpec[t_nIndex] == '$')
+        return -1;
+
+    // precision
+    if (p_sSpec[t_nIndex] == '.') {
+        t_nIndex++;
+        if (p_sSpec[t_nIndex] == '*') {
+            p_pSpec->m_bPrecArg = true;
+            t_nIndex++;
+        }
+        else {
+            p_pSpec->m_nPrecision = 0;
+            while ((p_sSpec[t_nIndex] >= '0') && (p_sSpec[t_nIndex] <= '9')) {
+                p_pSpec->m_nPrecision = (p_pSpec->m_nPrecision * 10) + (p_sSpec[t_nIndex] - '0');
+                t_nIndex++;
+            }
+        }
+    }
+
+    // length modifier
+    p_pSpec->m_nModStart = t_nIndex;
+    switch (p_sSpec[t_nIndex]) {
+        case 'h':
+            if (p_sSpec[t_nIndex + 1] == 'h') {
+                p_pSpec->m_cMod = 'H';
+                t_nIndex++;
+            }
+            else {
+                p_pSpec->m_cMod = 'h';
+            }
+            t_nIndex++;
+            break;
+        case 'l':
+            if (p_sSpec[t_nIndex + 1] == 'l') {
+                p_pSpec->m_cMod = 'q';
+                t_nIndex++;
+            }
+            else {
+                p_pSpec->m_cMod = 'l';
+            }
+            t_nIndex++;
+            break;
+        case 'q':
+        case 'j':
+        case 'z':
+        case 't':
+        case 'L':
+            p_pSpec->m_cMod = p_sSpec[t_nIndex];
+            t_nIndex++;
+            break;
+        default:
+            break;
+    }
+
+    p_pSpec->m_cConv = p_sSpec[t_nIndex];
+    p_pSpec->m_nLen = t_nIndex + 1;
+
+    // leave room to rebuild the specification with a different modifier
+    if (p_pSpec->m_nLen > (LGA_MAX_SPEC_LEN - 4))
+        return -1;
+
+    bool t_bShort = ((p_pSpec->m_cMod == 0) || (p_pSpec->m_cMod == 'H') || (p_pSpec->m_cMod == 'h'));
+    switch (p_pSpec->m_cConv) {
+        case 'd':
+        case 'i':
+            p_pSpec->m_type = (t_bShort ? LGA_ARG_INT : LGA_ARG_LLONG);
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            p_pSpec->m_type = (t_bShort ? LGA_ARG_UINT : LGA_ARG_ULLONG);
+            break;
+        case 'c':
+            if (p_pSpec->m_cMod != 0) return -1;
+            p_pSpec->m_type = LGA_ARG_INT;
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (p_pSpec->m_cMod == 'L') p_pSpec->m_type = LGA_ARG_LDOUBLE;
+            else if ((p_pSpec->m_cMod == 0) || (p_pSpec->m_cMod == 'l')) p_pSpec->m_type = LGA_ARG_DOUBLE;
+            else return -1;
+            break;
+        case 's':
+            if (p_pSpec->m_cMod != 0) return -1;
+            p_pSpec->m_type = LGA_ARG_STR;
+            break;
+        case 'p':
+            if (p_pSpec->m_cMod != 0) return -1;
+            p_pSpec->m_type = LGA_ARG_PTR;
+            break;
+        default:
+            // %n, %m, and anything unknown
+            return -1;
+    }
+
+    return p_pSpec->m_nLen;
+}
+
+/*
+ * Copies the specification into p_sDest, replacing its length modifier with
+ * the one that matches how the argument was stored.
+ */
+int _lga_build_spec(char* p_sDest, const char* p_sSpec, const t_lgaspec* p_pSpec) {
+
+    memcpy(p_sDest, p_sSpec, p_pSpec->m_nModStart);
+    int t_nIndex = p_pSpec->m_nModStart;
+
+    if ((p_pSpec->m_type == LGA_ARG_LLONG) || (p_pSpec->m_type == LGA_ARG_ULLONG)) {
+        p_sDest[t_nIndex++] = 'l';
+        p_sDest[t_nIndex++] = 'l';
+    }
+    else if (p_pSpec->m_type == LGA_ARG_LDOUBLE) {
+        p_sDest[t_nIndex++] = 'L';
+    }
+
+    p_sDest[t_nIndex++] = p_pSpec->m_cConv;
+    p_sDest[t_nIndex] = '\0';
+
+    return 0;
+}
+
+// public functions
+int lga_encode(char* p_pDest, size_t p_nSize, const char* p_sFormat, va_list p_listArgs) {
+
+    size_t t_nUsed = 0;
+
+#define LGA_PUT(type, value) \
+    do { \
+        type t_val = (value); \
+        if ((t_nUsed + sizeof(type)) > p_nSize) return -1; \
+        memcpy(p_pDest + t_nUsed, &t_val, sizeof(type)); \
+        t_nUsed += sizeof(type); \
+    } while (0)
+
+    for (const char* t_pCur = p_sFormat; *t_pCur != '\0'; t_pCur++) {
+        if (*t_pCur != '%')
+            continue;
+
+        t_lgaspec t_spec;
+        if (_lga_parse_spec(t_pCur, &t_spec) < 0)
+            return -1;
+        t_pCur += t_spec.m_nLen - 1;
+
+        int t_nPrecision = t_spec.m_nPrecision;
+        if (t_spec.m_bWidthArg) {
+            LGA_PUT(int, va_arg(p_listArgs, int));
+        }
+        if (t_spec.m_bPrecArg) {
+            t_nPrecision = va_arg(p_listArgs, int);
+            LGA_PUT(int, t_nPrecision);
+        }
+
+        switch (t_spec.m_type) {
+            case LGA_ARG_NONE:
+                break;
+            case LGA_ARG_INT:
+                if (t_spec.m_cMod == 'H') LGA_PUT(int, (signed char) va_arg(p_listArgs, int));
+                else if (t_spec.m_cMod == 'h') LGA_PUT(int, (short) va_arg(p_listArgs, int));
+                else LGA_PUT(int, va_arg(p_listArgs, int));
+                break;
+            case LGA_ARG_UINT:
+                if (t_spec.m_cMod == 'H') LGA_PUT(unsigned int, (unsigned char) va_arg(p_listArgs, unsigned int));
+                else if (t_spec.m_cMod == 'h') LGA_PUT(unsigned int, (unsigned short) va_arg(p_listArgs, unsigned int));
+                else LGA_PUT(unsigned int, va_arg(p_listArgs, unsigned int));
+                break;
+            case LGA_ARG_LLONG:
+                if (t_spec.m_cMod == 'l') LGA_PUT(long long, va_arg(p_listArgs, long));
+                else if (t_spec.m_cMod == 'j') LGA_PUT(long long, va_arg(p_listArgs, intmax_t));
+                else if (t_spec.m_cMod == 'z') LGA_PUT(long long, (ptrdiff_t) va_arg(p_listArgs, size_t));
+                else if (t_spec.m_cMod == 't') LGA_PUT(long long, va_arg(p_listArgs, ptrdiff_t));
+                else LGA_PUT(long long, va_arg(p_listArgs, long long));
+                break;
+            case LGA_ARG_ULLONG:
+                if (t_spec.m_cMod == 'l') LGA_PUT(unsigned long long, va_arg(p_listArgs, unsigned long));
+                else if (t_spec.m_cMod == 'j') LGA_PUT(unsigned long long, va_arg(p_listArgs, uintmax_t));
+                else if (t_spec.m_cMod == 'z') LGA_PUT(unsigned long long, va_arg(p_listArgs, size_t));
+                else if (t_spec.m_cMod == 't') LGA_PUT(unsigned long long, (size_t) va_arg(p_listArgs, ptrdiff_t));
+                else LGA_PUT(unsigned long long, va_arg(p_listArgs, unsigned long long));
+                break;
+            case LGA_ARG_DOUBLE:
+                LGA_PUT(double, va_arg(p_listArgs, double));
+                break;
+            case LGA_ARG_LDOUBLE:
+                LGA_PUT(long double, va_arg(p_listArgs, long double));
+                break;
+            case LGA_ARG_PTR:
+                LGA_PUT(void*, va_arg(p_listArgs, void*));
+                break;
+            case LGA_ARG_STR: {
+                const char* t_sArg = va_arg(p_listArgs, const char*);
+                if (t_sArg == NULL)
+                    t_sArg = "(null)";
+                // the string doesn't need to be terminated if a precision limits it
+                size_t t_nLen = (t_nPrecision >= 0 ? strnlen(t_sArg, t_nPrecision) : strlen(t_sArg));
+                if ((t_nUsed + t_nLen + 1) > p_nSize)
+                    return -1;
+                memcpy(p_pDest + t_nUsed, t_sArg, t_nLen);
+                p_pDest[t_nUsed + t_nLen] = '\0';
+                t_nUsed += t_nLen + 1;
+                break;
+            }
+        }
+    }
+
+#undef LGA_PUT
+
+    return (int) t_nUsed;
+}
+
+int lga_render(char* p_sDest, size_t p_nSize, const char* p_sFormat, const char* p_pArgs, size_t p_nArgsLen) {
+
+    if ((p_sDest == NULL) || (p_nSize == 0) || (p_sFormat == NULL))
+        return -1;
+
+    size_t t_nTotal = 0;
+    size_t t_nRead = 0;
+
+#define LGA_GET(type, dest) \
+    do { \
+        if ((t_nRead + sizeof(type)) > p_nArgsLen) return -1; \
+        memcpy(&(dest), p_pArgs + t_nRead, sizeof(type)); \
+        t_nRead += sizeof(type); \
+    } while (0)
+
+#define LGA_PRINT(value) \
+    ( \
+        (t_spec.m_bWidthArg && t_spec.m_bPrecArg) ? snprintf(t_pOut, t_nLeft, t_sSpec, t_nWidth, t_nPrec, value) : \
+        t_spec.m_bWidthArg ? snprintf(t_pOut, t_nLeft, t_sSpec, t_nWidth, value) : \
+        t_spec.m_bPrecArg ? snprintf(t_pOut, t_nLeft, t_sSpec, t_nPrec, value) : \
+        snprintf(t_pOut, t_nLeft, t_sSpec, value) \
+    )
+
+    const char* t_pCur = p_sFormat;
+    while (*t_pCur != '\0') {
+
+        // copy everything up to the next specification
+        const char* t_pNext = strchr(t_pCur, '%');
+        size_t t_nLiteral = (t_pNext == NULL ? strlen(t_pCur) : (size_t) (t_pNext - t_pCur));
+        if (t_nTotal < p_nSize - 1) {
+            size_t t_nCopy = t_nLiteral;
+            if (t_nCopy > p_nSize - 1 - t_nTotal)
+                t_nCopy = p_nSize - 1 - t_nTotal;
+            memcpy(p_sDest + t_nTotal, t_pCur, t_nCopy);
+        }
+        t_nTotal += t_nLiteral;
+        if (t_pNext == NULL)
+            break;
+        t_pCur = t_pNext;
+
+        t_lgaspec t_spec;
+        if (_lga_parse_spec(t_pCur, &t_spec) < 0)
+            return -1;
+
+        char t_sSpec[LGA_MAX_SPEC_LEN];
+        _lga_build_spec(t_sSpec, t_pCur, &t_spec);
+        t_pCur += t_spec.m_nLen;
+
+        int t_nWidth = 0;
+        int t_nPrec = 0;
+        if (t_spec.m_bWidthArg) LGA_GET(int, t_nWidth);
+        if (t_spec.m_bPrecArg) LGA_GET(int, t_nPrec);
+
+        char* t_pOut = (t_nTotal < p_nSize ? p_sDest + t_nTotal : NULL);
+        size_t t_nLeft = (t_nTotal < p_nSize ? p_nSize - t_nTotal : 0);
+        int t_nPrinted = 0;
+
+        switch (t_spec.m_type) {
+            case LGA_ARG_NONE:
+                t_nPrinted = snprintf(t_pOut, t_nLeft, "%%");
+                break;
+            case LGA_ARG_INT: {
+                int t_val;
+                LGA_GET(int, t_val);
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+            case LGA_ARG_UINT: {
+                unsigned int t_val;
+                LGA_GET(unsigned int, t_val);
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+            case LGA_ARG_LLONG: {
+                long long t_val;
+                LGA_GET(long long, t_val);
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+            case LGA_ARG_ULLONG: {
+                unsigned long long t_val;
+                LGA_GET(unsigned long long, t_val);
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+            case LGA_ARG_DOUBLE: {
+                double t_val;
+                LGA_GET(double, t_val);
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+            case LGA_ARG_LDOUBLE: {
+                long double t_val;
+                LGA_GET(long double, t_val);
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+            case LGA_ARG_PTR: {
+                void* t_val;
+                LGA_GET(void*, t_val);
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+            case LGA_ARG_STR: {
+                const char* t_val = p_pArgs + t_nRead;
+                size_t t_nLen = strnlen(t_val, p_nArgsLen - t_nRead);
+                if (t_nRead + t_nLen >= p_nArgsLen)
+                    return -1;
+                t_nRead += t_nLen + 1;
+                t_nPrinted = LGA_PRINT(t_val);
+                break;
+            }
+        }
+
+        if (t_nPrinted < 0)
+            return -1;
+        t_nTotal += t_nPrinted;
+    }
+
+#undef LGA_PRINT
+#undef LGA_GET
+
+    p_sDest[(t_nTotal < p_nSize ? t_nTotal : p_nSize - 1)] = '\0';
+
+    return (int) t_nTotal;
+}
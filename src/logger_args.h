@@ -0,0 +1,34 @@
+#ifndef LOGGER_ARGS_H_INCLUDED
+#define LOGGER_ARGS_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/*
+ * Copies the arguments that p_sFormat uses out of p_listArgs and into
+ * p_pDest so the message can be formatted later by lga_render(). Strings are
+ * copied by value.
+ *
+ * Returns the number of bytes written to p_pDest, or -1 if the arguments
+ * don't fit or p_sFormat uses a conversion that can't be deferred (%n, %m,
+ * wide characters, or positional arguments).
+ */
+int lga_encode(char* p_pDest, size_t p_nSize, const char* p_sFormat, va_list p_listArgs);
+
+/*
+ * Formats p_sFormat into p_sDest using arguments stored by lga_encode().
+ *
+ * Returns the number of characters that would have been written if p_nSize
+ * was large enough, like snprintf(), or -1 on error.
+ */
+int lga_render(char* p_sDest, size_t p_nSize, const char* p_sFormat, const char* p_pArgs, size_t p_nArgsLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
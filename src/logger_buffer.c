@@ -2,22 +2,31 @@
 #include "logger_buffer.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h> // sched_yield()
 #include <semaphore.h>
 #include <stdatomic.h>
+#include <stddef.h> // ptrdiff_t
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h> // memset()
 
 #ifndef LOGGER_SLEEP_SECS
 #define LOGGER_SLEEP_SECS 1
 #endif
 
 #ifndef BUFFER_CLOSE_WARN
-#define BUFFER_CLOSE_WARN 5 // stop adding messages to buffer when there's this number or fewer free spaces
+#define BUFFER_CLOSE_WARN 5 // stop adding messages to buffer when there's room for this number or fewer full-size messages
 #endif
 
+// one for the logger, one for each handler with its own thread, and one for each thread logging on its own buffer
 #ifndef LOGGER_BUFFER_MAX_NUM_BUFFERS
-#define LOGGER_BUFFER_MAX_NUM_BUFFERS 3
+#define LOGGER_BUFFER_MAX_NUM_BUFFERS (1 + CLOGGER_MAX_NUM_HANDLERS + CLOGGER_MAX_NUM_THREAD_BUFFERS)
 #endif
 
+// words needed for one bit per buffer
+#define LOGGER_BUFFER_CHILD_WORDS ((LOGGER_BUFFER_MAX_NUM_BUFFERS + 63) / 64)
+
 #if BUFFER_CLOSE_WARN > CLOGGER_BUFFER_SIZE
 #error "BUFFER_CLOSE_WARN must be less than CLOGGER_BUFFER_SIZE"
 #endif
@@ -26,22 +35,135 @@
 #error "BUFFER_CLOSE_WARN must be > 0"
 #endif
 
+#ifndef LOGGER_BUFFER_CACHE_LINE
+#define LOGGER_BUFFER_CACHE_LINE 64
+#endif
+
+#ifndef LOGGER_BUFFER_SPIN_COUNT
+#define LOGGER_BUFFER_SPIN_COUNT 200 // checks for a message before the reader goes to sleep
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOGGER_BUFFER_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define LOGGER_BUFFER_CPU_RELAX()
+#endif
+
+#define LOGGER_BUFFER_REC_ALIGN 8
+
+#define LOGGER_BUFFER_REC_FREE      0   // not written yet, or not committed by its producer
+#define LOGGER_BUFFER_REC_MSG       1
+#define LOGGER_BUFFER_REC_DISCARD   2
+#define LOGGER_BUFFER_REC_PAD       3   // fills the space left at the end of the buffer
+
+/*
+ * Every message on the buffer is stored in a record: this header, the
+ * t_loggerrec, then the message's data. Records are variable length, so a
+ * short message only uses the space it needs.
+ *
+ * The reader zeroes each record after it's done with it, so any free space
+ * on the buffer is all zeros. That lets the reader tell a record a producer
+ * has claimed but not committed (m_nState is still LOGGER_BUFFER_REC_FREE)
+ * from one that's ready.
+ */
+typedef struct {
+    _Atomic uint32_t    m_nState;
+    uint32_t            m_nLen;     // length of the whole record, including this header
+} logger_buffer_rec;
+
+// the space needed by a record holding a message of CLOGGER_MAX_MESSAGE_SIZE
+#define LOGGER_BUFFER_FULL_REC_SIZE \
+    (_lgb_align(sizeof(logger_buffer_rec) + sizeof(t_loggerrec) + sizeof(t_loggersrc) + CLOGGER_MAX_MESSAGE_SIZE))
+
+// by default the buffer can hold at least CLOGGER_BUFFER_SIZE full-size messages
+#define LOGGER_BUFFER_CAPACITY (CLOGGER_BUFFER_SIZE * LOGGER_BUFFER_FULL_REC_SIZE)
+
+#define LOGGER_BUFFER_WARN_BYTES (BUFFER_CLOSE_WARN * LOGGER_BUFFER_FULL_REC_SIZE)
+
+// the space above the warning size needed to always fit a full-size message (see _lgb_max_rec_len())
+#define LOGGER_BUFFER_MIN_USABLE ((2 * LOGGER_BUFFER_FULL_REC_SIZE) - LOGGER_BUFFER_REC_ALIGN)
+
+// record lengths are stored in 32 bits, so keep the whole buffer well below that
+#define LOGGER_BUFFER_MAX_CAPACITY ((size_t) 1 << 30)
+
+/*
+ * The write and read positions count bytes and only ever increase; the
+ * capacity is a power of two, so the offset in m_pData is the position
+ * masked with m_nMask. They're kept on
+ * their own cache lines so producers claiming space don't invalidate the
+ * line the logger thread reads from.
+ *
+ * m_nBatchEnd is only used by the reader; it's the position after the last
+ * record returned by lgb_read_batch(). It's only meaningful while m_bReading
+ * is set.
+ *
+ * When the reader has nothing to do it sets abparked and sleeps on wake; a
+ * producer only posts to wake after it sees abparked set, so producers don't
+ * make a syscall while the reader is busy.
+ *
+ * The reader holds readlock from the time it reads messages until it releases
+ * them (m_bReading is set while it does), so a producer that drops the oldest
+ * messages with lgb_drop_oldest() never frees one the reader is using.
+ * Producers waiting for space in lgb_wait_for_space() are counted in
+ * anspacewaiters. When there are any, the reader bumps m_nSpaceGen under
+ * spacelock after it frees space and wakes them all with spacecond; a waiter
+ * only sleeps until the generation it saw changes, so a wakeup no one waited
+ * for isn't left behind for a later waiter.
+ *
+ * A thread buffer (see lgb_create_thread_buffer()) has one producer, so it
+ * claims space without a CAS (m_bSingleProducer). Its bit is set in its
+ * parent's anchildren, and it wakes its parent's reader instead of having a
+ * reader of its own. Once its thread exits (abretired), the reader removes it
+ * as soon as it's empty.
+ */
 typedef struct {
-    t_loggermsg*    messages[CLOGGER_BUFFER_SIZE];
-    sem_t           rlock;
-    sem_t           wlock;
-    atomic_int      amsgs;
-    atomic_int      arindx;
-    atomic_int      awindx;
+    _Alignas(LOGGER_BUFFER_CACHE_LINE) atomic_size_t    awpos;
+    _Alignas(LOGGER_BUFFER_CACHE_LINE) atomic_size_t    arpos;
+    _Alignas(LOGGER_BUFFER_CACHE_LINE) atomic_bool      abparked;
+    atomic_bool                                         abwake;
+    sem_t                                               wake;
+    sem_t                                               readlock;
+    pthread_mutex_t                                     spacelock;
+    pthread_cond_t                                      spacecond;
+    unsigned long                                       m_nSpaceGen;
+    atomic_int                                          anspacewaiters;
+    bool                                                m_bReading;
+    size_t                                              m_nCapacity;
+    size_t                                              m_nMask;    // m_nCapacity - 1
+    size_t                                              m_nWarnBytes;
+    size_t                                              m_nBatchEnd;
+    bool                                                m_bSingleProducer;
+    int                                                 m_nParentRef;   // -1 unless this is a thread buffer
+    atomic_bool                                         abretired;
+    _Atomic uint64_t                                    anchildren[LOGGER_BUFFER_CHILD_WORDS];
+    _Alignas(LOGGER_BUFFER_CACHE_LINE) char             m_pData[];
 } logger_buffer;
 
 // global variables
 static logger_buffer** buffers = { NULL };
 static sem_t* g_pStorageSem = { NULL };
 
+// the size of every buffer; set by lgb_init()
+static size_t g_nCapacity = { 0 };
+static size_t g_nWarnBytes = { 0 };
+static size_t g_nThreadCapacity = { 0 };   // 0 when threads share the logger's buffer
+
 // private function declarations
 static int _lgb_check_values(int bufref);
-static int _lgb_get_new_index(int current_index);
+static bool _lgb_has_message(logger_buffer* p_pBuffer);
+static bool _lgb_group_has_message(logger_buffer* p_pBuffer);
+static size_t _lgb_round_capacity(size_t p_nRequested);
+static int _lgb_create_buffer(size_t p_nCapacity, bool p_bSingleProducer, int p_nParentRef);
+static void _lgb_release_span(logger_buffer* p_pBuffer);
+static int _lgb_read_merged(logger_buffer* p_pBuffer, t_loggerrec** p_pMsgs, int p_nMax);
+static void _lgb_wake_reader(logger_buffer* p_pBuffer);
+static int _lgb_unpark(logger_buffer* p_pBuffer);
+static int _lgb_publish(int bufref, t_loggerrec* msg, uint32_t p_nState);
+static void _lgb_begin_read(logger_buffer* p_pBuffer);
+static void _lgb_end_read(logger_buffer* p_pBuffer);
+static logger_buffer_rec* _lgb_rec_at(logger_buffer* p_pBuffer, size_t p_nPos);
+static size_t _lgb_align(size_t p_nLen);
+static size_t _lgb_max_rec_len(logger_buffer* p_pBuffer);
 
 // private function definitions
 int _lgb_check_values(int bufref) {
@@ -70,16 +192,263 @@ int _lgb_check_values(int bufref) {
     return 0;
 }
 
-static int _lgb_get_new_index(int current_index) {
-    int new_index = current_index + 1;
-    if (new_index >= CLOGGER_BUFFER_SIZE) {
-        return 0; // roll the value over to 0 if we reached the max size
+size_t _lgb_align(size_t p_nLen) {
+    return (p_nLen + (LOGGER_BUFFER_REC_ALIGN - 1)) & ~((size_t) LOGGER_BUFFER_REC_ALIGN - 1);
+}
+
+/*
+ * Returns the length of the longest record that always fits on an empty
+ * buffer. A record can't wrap around the end of the buffer, so it can need
+ * almost its own length in padding in front of it.
+ */
+size_t _lgb_max_rec_len(logger_buffer* p_pBuffer) {
+    size_t t_nUsable = p_pBuffer->m_nCapacity - p_pBuffer->m_nWarnBytes;
+    return ((t_nUsable + LOGGER_BUFFER_REC_ALIGN) / 2) & ~((size_t) LOGGER_BUFFER_REC_ALIGN - 1);
+}
+
+logger_buffer_rec* _lgb_rec_at(logger_buffer* p_pBuffer, size_t p_nPos) {
+    return (logger_buffer_rec*) (p_pBuffer->m_pData + (p_nPos & p_pBuffer->m_nMask));
+}
+
+/*
+ * Returns true when the record at the read position has been committed by
+ * its producer.
+ */
+bool _lgb_has_message(logger_buffer* p_pBuffer) {
+    size_t t_nReadPos = atomic_load_explicit(&p_pBuffer->arpos, memory_order_relaxed);
+    logger_buffer_rec* t_pRec = _lgb_rec_at(p_pBuffer, t_nReadPos);
+    return (atomic_load_explicit(&t_pRec->m_nState, memory_order_acquire) != LOGGER_BUFFER_REC_FREE);
+}
+
+/*
+ * Returns true when the buffer, or any of its thread buffers, has a message
+ * ready.
+ */
+bool _lgb_group_has_message(logger_buffer* p_pBuffer) {
+    if (_lgb_has_message(p_pBuffer))
+        return true;
+
+    for (int t_nWord = 0; t_nWord < LOGGER_BUFFER_CHILD_WORDS; t_nWord++) {
+        uint64_t t_nChildren = atomic_load_explicit(&p_pBuffer->anchildren[t_nWord], memory_order_acquire);
+        while (t_nChildren != 0) {
+            int t_nBit = __builtin_ctzll(t_nChildren);
+            t_nChildren &= t_nChildren - 1;
+            if (_lgb_has_message(buffers[(t_nWord * 64) + t_nBit]))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns the smallest power of two that's at least p_nRequested bytes, or
+ * 0 if that's too large.
+ */
+size_t _lgb_round_capacity(size_t p_nRequested) {
+    if (p_nRequested > LOGGER_BUFFER_MAX_CAPACITY)
+        return 0;
+
+    size_t t_nCapacity = LOGGER_BUFFER_CACHE_LINE;
+    while (t_nCapacity < p_nRequested)
+        t_nCapacity <<= 1;
+    return t_nCapacity;
+}
+
+/*
+ * Posts to the reader's semaphore if it's parked. Only the thread that clears
+ * abparked posts, so the reader is woken once no matter how many producers
+ * see the flag.
+ */
+void _lgb_wake_reader(logger_buffer* p_pBuffer) {
+    // make our last store visible before checking if the reader is asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&p_pBuffer->abparked, memory_order_relaxed))
+        return;
+    if (atomic_exchange(&p_pBuffer->abparked, false))
+        sem_post(&p_pBuffer->wake);
+}
+
+/*
+ * Called by the reader to stop being parked without sleeping on the semaphore.
+ *
+ * If a producer already cleared abparked it has posted (or is about to post)
+ * to the semaphore; consume that post so it doesn't cut the next wait short.
+ */
+int _lgb_unpark(logger_buffer* p_pBuffer) {
+    if (!atomic_exchange(&p_pBuffer->abparked, false)) {
+        while (sem_wait(&p_pBuffer->wake) == -1) {
+            if (errno != EINTR) {
+                lgu_warn_msg_int("failed to wait on buffer wake semaphore; errno: %d", errno);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int _lgb_publish(int bufref, t_loggerrec* msg, uint32_t p_nState) {
+
+    if (_lgb_check_values(bufref))
+        return 1;
+    else if (msg == NULL) {
+        lgu_warn_msg("can't publish a NULL message.");
+        return 1;
+    }
+
+    logger_buffer_rec* t_pRec = ((logger_buffer_rec*) msg) - 1;
+    atomic_store_explicit(&t_pRec->m_nState, p_nState, memory_order_release);
+
+    // a thread buffer is read by its parent's reader
+    logger_buffer* t_pBuffer = buffers[bufref];
+    if (t_pBuffer->m_nParentRef >= 0)
+        t_pBuffer = buffers[t_pBuffer->m_nParentRef];
+    _lgb_wake_reader(t_pBuffer);
+
+    return 0;
+}
+
+/*
+ * Called by the reader before it reads any messages. Keeps producers from
+ * dropping the messages it's about to use.
+ */
+void _lgb_begin_read(logger_buffer* p_pBuffer) {
+    if (p_pBuffer->m_bReading)
+        return;
+    while (sem_wait(&p_pBuffer->readlock) == -1) {
+        if (errno != EINTR) {
+            lgu_warn_msg_int("failed to get the buffer read lock; errno: %d", errno);
+            return;
+        }
+    }
+    p_pBuffer->m_bReading = true;
+}
+
+/*
+ * Called by the reader after it gives space back to the buffer. Lets
+ * producers drop messages again, and wakes any waiting for space.
+ */
+void _lgb_end_read(logger_buffer* p_pBuffer) {
+    if (p_pBuffer->m_bReading) {
+        p_pBuffer->m_bReading = false;
+        sem_post(&p_pBuffer->readlock);
+    }
+
+    // make the new read position visible before checking for waiting producers
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&p_pBuffer->anspacewaiters, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&p_pBuffer->spacelock);
+        p_pBuffer->m_nSpaceGen++;
+        pthread_cond_broadcast(&p_pBuffer->spacecond);
+        pthread_mutex_unlock(&p_pBuffer->spacelock);
+    }
+}
+
+/*
+ * Frees every record up to m_nBatchEnd, which was set by the last read. Does
+ * nothing to a buffer that wasn't read; producers can have dropped messages
+ * from it since m_nBatchEnd was set.
+ */
+void _lgb_release_span(logger_buffer* p_pBuffer) {
+    if (!p_pBuffer->m_bReading)
+        return;
+
+    size_t t_nReadPos = atomic_load_explicit(&p_pBuffer->arpos, memory_order_relaxed);
+    size_t t_nLen = p_pBuffer->m_nBatchEnd - t_nReadPos;
+    if (t_nLen == 0) {
+        _lgb_end_read(p_pBuffer);
+        return;
+    }
+
+    // a record never wraps the end of the data, but a batch can
+    size_t t_nOffset = t_nReadPos & p_pBuffer->m_nMask;
+    size_t t_nFirst = p_pBuffer->m_nCapacity - t_nOffset;
+    if (t_nLen <= t_nFirst) {
+        memset(p_pBuffer->m_pData + t_nOffset, 0, t_nLen);
+    }
+    else {
+        memset(p_pBuffer->m_pData + t_nOffset, 0, t_nFirst);
+        memset(p_pBuffer->m_pData, 0, t_nLen - t_nFirst);
+    }
+    atomic_store_explicit(&p_pBuffer->arpos, p_pBuffer->m_nBatchEnd, memory_order_release);
+    _lgb_end_read(p_pBuffer);
+}
+
+/*
+ * lgb_read_batch() for a buffer with thread buffers. Takes the ready messages
+ * from all of them, oldest timestamp first; each buffer's messages stay in the
+ * order they were logged.
+ */
+int _lgb_read_merged(logger_buffer* p_pBuffer, t_loggerrec** p_pMsgs, int p_nMax) {
+
+    logger_buffer* t_pRings[LOGGER_BUFFER_MAX_NUM_BUFFERS];
+    size_t t_nPos[LOGGER_BUFFER_MAX_NUM_BUFFERS];
+    t_loggerrec* t_pHeads[LOGGER_BUFFER_MAX_NUM_BUFFERS];
+    int t_nRings = 0;
+
+    t_pRings[t_nRings++] = p_pBuffer;
+    for (int t_nWord = 0; t_nWord < LOGGER_BUFFER_CHILD_WORDS; t_nWord++) {
+        uint64_t t_nChildren = atomic_load_explicit(&p_pBuffer->anchildren[t_nWord], memory_order_acquire);
+        while (t_nChildren != 0) {
+            int t_nBit = __builtin_ctzll(t_nChildren);
+            t_nChildren &= t_nChildren - 1;
+            t_pRings[t_nRings++] = buffers[(t_nWord * 64) + t_nBit];
+        }
+    }
+
+    for (int t_nRing = 0; t_nRing < t_nRings; t_nRing++) {
+        _lgb_begin_read(t_pRings[t_nRing]);
+        t_nPos[t_nRing] = atomic_load_explicit(&t_pRings[t_nRing]->arpos, memory_order_relaxed);
+        t_pHeads[t_nRing] = NULL;
     }
-    return new_index;
+
+    int t_nCount = 0;
+    while (t_nCount < p_nMax) {
+        int t_nOldest = -1;
+        for (int t_nRing = 0; t_nRing < t_nRings; t_nRing++) {
+            // find the next message on this buffer, skipping padding and discarded records
+            while (t_pHeads[t_nRing] == NULL) {
+                logger_buffer_rec* t_pRec = _lgb_rec_at(t_pRings[t_nRing], t_nPos[t_nRing]);
+                uint32_t t_nState = atomic_load_explicit(&t_pRec->m_nState, memory_order_acquire);
+                if (t_nState == LOGGER_BUFFER_REC_FREE)
+                    break;
+                else if (t_nState == LOGGER_BUFFER_REC_MSG)
+                    t_pHeads[t_nRing] = (t_loggerrec*) (t_pRec + 1);
+                else
+                    t_nPos[t_nRing] += t_pRec->m_nLen;
+            }
+
+            if ((t_pHeads[t_nRing] != NULL) &&
+                ((t_nOldest < 0) || (t_pHeads[t_nRing]->m_nTimestamp < t_pHeads[t_nOldest]->m_nTimestamp)))
+                t_nOldest = t_nRing;
+        }
+        if (t_nOldest < 0)
+            break;
+
+        p_pMsgs[t_nCount++] = t_pHeads[t_nOldest];
+        t_nPos[t_nOldest] += (((logger_buffer_rec*) t_pHeads[t_nOldest]) - 1)->m_nLen;
+        t_pHeads[t_nOldest] = NULL;
+    }
+
+    for (int t_nRing = 0; t_nRing < t_nRings; t_nRing++)
+        t_pRings[t_nRing]->m_nBatchEnd = t_nPos[t_nRing];
+
+    return t_nCount;
 }
 
 // public functions
-int lgb_init() {
+
+/*
+ * Sets up storage for the buffers and creates the logger's buffer. Every
+ * buffer gets p_nCapacity bytes, rounded up to a power of two, and producers
+ * stop adding messages when only p_nWarnBytes are left. Either can be 0 to
+ * use the size set when the library was built.
+ *
+ * Thread buffers get p_nThreadCapacity bytes, also rounded up; 0 means
+ * lgb_create_thread_buffer() always fails, so every thread shares a buffer.
+ *
+ * Returns a reference to the logger's buffer, or -1 on error.
+ */
+int lgb_init(size_t p_nCapacity, size_t p_nWarnBytes, size_t p_nThreadCapacity) {
 
     if (BUFFER_CLOSE_WARN > CLOGGER_BUFFER_SIZE) {
         lgu_warn_msg("Buffer warning size can't be greater than buffer size");
@@ -94,6 +463,24 @@ int lgb_init() {
         return -1;
     }
 
+    size_t t_nWarnBytes = (p_nWarnBytes > 0 ? _lgb_align(p_nWarnBytes) : LOGGER_BUFFER_WARN_BYTES);
+    size_t t_nCapacity = _lgb_round_capacity(p_nCapacity > 0 ? p_nCapacity : LOGGER_BUFFER_CAPACITY);
+    size_t t_nThreadCapacity = _lgb_round_capacity(p_nThreadCapacity);
+    if ((t_nCapacity == 0) || ((p_nThreadCapacity > 0) && (t_nThreadCapacity == 0))) {
+        lgu_warn_msg_int("The buffer can't be larger than %d bytes", (int) LOGGER_BUFFER_MAX_CAPACITY);
+        return -1;
+    }
+    // a full-size message must fit wherever the buffer wraps, so leave room for its padding too
+    else if ((t_nWarnBytes >= t_nCapacity) || ((t_nCapacity - t_nWarnBytes) < LOGGER_BUFFER_MIN_USABLE)) {
+        lgu_warn_msg("The buffer must have room for two full-size messages above the warning size");
+        return -1;
+    }
+    else if ((p_nThreadCapacity > 0) &&
+        ((t_nWarnBytes >= t_nThreadCapacity) || ((t_nThreadCapacity - t_nWarnBytes) < LOGGER_BUFFER_MIN_USABLE))) {
+        lgu_warn_msg("Thread buffers must have room for two full-size messages above the warning size");
+        return -1;
+    }
+
     if (buffers != NULL) {
         lgu_warn_msg("buffers have already been allocated.");
         return -1;
@@ -115,6 +502,10 @@ int lgb_init() {
     for (int count = 0; count < LOGGER_BUFFER_MAX_NUM_BUFFERS; count++)
         buffers[count] = NULL;
 
+    g_nCapacity = t_nCapacity;
+    g_nWarnBytes = t_nWarnBytes;
+    g_nThreadCapacity = (p_nThreadCapacity > 0 ? t_nThreadCapacity : 0);
+
     sem_post(g_pStorageSem);
     int buffer_create_rtn = lgb_create_buffer();
     if (buffer_create_rtn < 0) {
@@ -148,6 +539,7 @@ int lgb_free() {
 
     sem_destroy(g_pStorageSem);
     free(g_pStorageSem);
+    g_pStorageSem = NULL;
 
     free(buffers);
     buffers = NULL;
@@ -156,6 +548,52 @@ int lgb_free() {
 }
 
 int lgb_create_buffer() {
+    return _lgb_create_buffer(g_nCapacity, false, -1);
+}
+
+/*
+ * Creates a buffer for a single producer thread. Its messages are read along
+ * with p_nParentRef's by lgb_read_batch(), so the parent's reader sees
+ * them without knowing about the new buffer. The thread must call
+ * lgb_retire_buffer() before it exits.
+ *
+ * Returns a reference to the buffer, or -1 if it couldn't be created.
+ */
+int lgb_create_thread_buffer(int p_nParentRef) {
+
+    if (_lgb_check_values(p_nParentRef))
+        return -1;
+    else if (g_nThreadCapacity == 0)
+        return -1;
+
+    int t_nBufRef = _lgb_create_buffer(g_nThreadCapacity, true, p_nParentRef);
+    if (t_nBufRef < 0)
+        return -1;
+
+    // the bit is the parent reader's cue to start reading the new buffer
+    atomic_fetch_or_explicit(
+        &buffers[p_nParentRef]->anchildren[t_nBufRef / 64],
+        (uint64_t) 1 << (t_nBufRef % 64),
+        memory_order_release
+    );
+
+    return t_nBufRef;
+}
+
+/*
+ * Marks a thread buffer as no longer used by its thread. The parent's reader
+ * removes it once it's empty.
+ */
+int lgb_retire_buffer(int bufref) {
+
+    if (_lgb_check_values(bufref))
+        return 1;
+
+    atomic_store(&buffers[bufref]->abretired, true);
+    return 0;
+}
+
+int _lgb_create_buffer(size_t p_nCapacity, bool p_bSingleProducer, int p_nParentRef) {
 
     if (buffers == NULL) {
         lgu_warn_msg("no space has been allocated for buffers.");
@@ -177,32 +615,60 @@ int lgb_create_buffer() {
         return -1;
     }
 
-    buffers[buf_count] = (logger_buffer*) malloc(sizeof(logger_buffer));
+    // the positions must be aligned to keep them on separate cache lines
+    size_t t_nCapacity = p_nCapacity;
+    size_t t_nAllocSize = sizeof(logger_buffer) + t_nCapacity;
+    t_nAllocSize += (LOGGER_BUFFER_CACHE_LINE - (t_nAllocSize % LOGGER_BUFFER_CACHE_LINE)) % LOGGER_BUFFER_CACHE_LINE;
+    buffers[buf_count] = (logger_buffer*) aligned_alloc(LOGGER_BUFFER_CACHE_LINE, t_nAllocSize);
     if (buffers[buf_count] == NULL) {
         lgu_warn_msg("failed to allocate space for new buffer.");
         sem_post(g_pStorageSem);
         return -1;
     }
 
-    buffers[buf_count]->arindx = 0;
-    buffers[buf_count]->awindx = 0;
-
-    for (int count = 0; count < CLOGGER_BUFFER_SIZE; count++)
-        buffers[buf_count]->messages[count] = NULL;
+    atomic_init(&buffers[buf_count]->awpos, 0);
+    atomic_init(&buffers[buf_count]->arpos, 0);
+    atomic_init(&buffers[buf_count]->abparked, false);
+    atomic_init(&buffers[buf_count]->abwake, false);
 
-    if (sem_init(&buffers[buf_count]->rlock, 0, 1)) {
-        lgu_warn_msg_int("Failed to create the rlock; errno: %d.", errno);
+    if (sem_init(&buffers[buf_count]->wake, 0, 0)) {
+        lgu_warn_msg_int("Failed to create the wake semaphore; errno: %d.", errno);
+        free(buffers[buf_count]);
+        buffers[buf_count] = NULL;
         sem_post(g_pStorageSem);
         return -1;
     }
-
-    if (sem_init(&buffers[buf_count]->wlock, 0, 1)) {
-        lgu_warn_msg_int("Failed to create the wlock; errno: %d.", errno);
+    else if (sem_init(&buffers[buf_count]->readlock, 0, 1)) {
+        lgu_warn_msg_int("Failed to create the buffer semaphores; errno: %d.", errno);
+        sem_destroy(&buffers[buf_count]->wake);
+        free(buffers[buf_count]);
+        buffers[buf_count] = NULL;
         sem_post(g_pStorageSem);
         return -1;
     }
-
-    buffers[buf_count]->amsgs = 0;
+    else if (pthread_mutex_init(&buffers[buf_count]->spacelock, NULL) || pthread_cond_init(&buffers[buf_count]->spacecond, NULL)) {
+        lgu_warn_msg("Failed to create the lock producers wait for space on.");
+        sem_destroy(&buffers[buf_count]->wake);
+        sem_destroy(&buffers[buf_count]->readlock);
+        free(buffers[buf_count]);
+        buffers[buf_count] = NULL;
+        sem_post(g_pStorageSem);
+        return -1;
+    }
+    buffers[buf_count]->m_nSpaceGen = 0;
+    atomic_init(&buffers[buf_count]->anspacewaiters, 0);
+    buffers[buf_count]->m_bReading = false;
+
+    buffers[buf_count]->m_nCapacity = t_nCapacity;
+    buffers[buf_count]->m_nMask = t_nCapacity - 1;
+    buffers[buf_count]->m_nWarnBytes = g_nWarnBytes;
+    buffers[buf_count]->m_nBatchEnd = atomic_load_explicit(&buffers[buf_count]->arpos, memory_order_relaxed);
+    buffers[buf_count]->m_bSingleProducer = p_bSingleProducer;
+    buffers[buf_count]->m_nParentRef = p_nParentRef;
+    atomic_init(&buffers[buf_count]->abretired, false);
+    for (int t_nWord = 0; t_nWord < LOGGER_BUFFER_CHILD_WORDS; t_nWord++)
+        atomic_init(&buffers[buf_count]->anchildren[t_nWord], 0);
+    memset(buffers[buf_count]->m_pData, 0, t_nCapacity);
 
     sem_post(g_pStorageSem);
 
@@ -217,29 +683,27 @@ int lgb_remove_buffer(int bufref) {
     // get the global lock to modify storage
     sem_wait(g_pStorageSem);
 
-    // get both locks on the buffer that will be removed
-    sem_wait(&buffers[bufref]->rlock);
-    sem_wait(&buffers[bufref]->wlock);
-
-    // look for any messages on the buffer and free them
+    // count any messages still on the buffer; they're lost with it
     int t_nMsgDropped = 0;
-    for (int count = 0; count < CLOGGER_BUFFER_SIZE; count++) {
-        if (buffers[bufref]->messages[count] != NULL) {
-            free(buffers[bufref]->messages[count]);
-            buffers[bufref]->messages[count] = NULL;
+    size_t t_nWritePos = atomic_load(&buffers[bufref]->awpos);
+    size_t t_nPos = atomic_load(&buffers[bufref]->arpos);
+    while (t_nPos < t_nWritePos) {
+        logger_buffer_rec* t_pRec = _lgb_rec_at(buffers[bufref], t_nPos);
+        if (t_pRec->m_nLen == 0)
+            break; // claimed but never written
+        if (atomic_load(&t_pRec->m_nState) == LOGGER_BUFFER_REC_MSG)
             t_nMsgDropped++;
-        }
+        t_nPos += t_pRec->m_nLen;
     }
 
     if (t_nMsgDropped) {
         lgu_warn_msg_int("'%d' messages were dropped while buffer was being destroyed", t_nMsgDropped);
     }
 
-    buffers[bufref]->amsgs = 0;
-
-    // destroy the buffer's locks
-    sem_destroy(&buffers[bufref]->rlock);
-    sem_destroy(&buffers[bufref]->wlock);
+    sem_destroy(&buffers[bufref]->wake);
+    sem_destroy(&buffers[bufref]->readlock);
+    pthread_cond_destroy(&buffers[bufref]->spacecond);
+    pthread_mutex_destroy(&buffers[bufref]->spacelock);
 
     // free the memory used by the buffer
     free(buffers[bufref]);
@@ -251,62 +715,340 @@ int lgb_remove_buffer(int bufref) {
     return 0;
 }
 
-int lgb_add_message(int bufref, t_loggermsg* msg) {
+/*
+ * Returns the most data a message on the buffer can have; see
+ * lgb_reserve_message(). Returns 0 on error.
+ */
+size_t lgb_get_max_data(int bufref) {
 
     if (_lgb_check_values(bufref))
-        return 1;
+        return 0;
 
-    sem_wait(&buffers[bufref]->wlock); // get the lock
+    return _lgb_max_rec_len(buffers[bufref]) - sizeof(logger_buffer_rec) - sizeof(t_loggerrec);
+}
 
-    // make sure there aren't too many messages on the buffer
-    if ((CLOGGER_BUFFER_SIZE - buffers[bufref]->amsgs) <= BUFFER_CLOSE_WARN) {
-        lgu_warn_msg("there are too many unread messages.");
-        sem_post(&buffers[bufref]->wlock);
-        return 1;
+/*
+ * Claims space on the buffer for a message with p_nDataLen bytes of data,
+ * without taking a lock, and returns the record stored there. The record's
+ * m_pData member has room for p_nDataLen bytes.
+ *
+ * Producers claim space by advancing the write position with a CAS. The
+ * caller fills in the returned message, then must pass it to either
+ * lgb_commit_message() or lgb_discard_message(); the logger thread can't read
+ * past the message until one of them is called. Any number of threads may
+ * call this at the same time.
+ *
+ * Returns NULL if the buffer is too full, or if the message has more than
+ * lgb_get_max_data() bytes of data.
+ */
+t_loggerrec* lgb_reserve_message(int bufref, size_t p_nDataLen) {
+
+    if (_lgb_check_values(bufref))
+        return NULL;
+
+    logger_buffer* t_pBuffer = buffers[bufref];
+    size_t t_nRecLen = _lgb_align(sizeof(logger_buffer_rec) + sizeof(t_loggerrec) + p_nDataLen);
+    if (t_nRecLen > _lgb_max_rec_len(t_pBuffer)) {
+        lgu_warn_msg("the message is too large for the buffer.");
+        return NULL;
     }
 
-    buffers[bufref]->messages[buffers[bufref]->awindx] = msg; // add the message
-    buffers[bufref]->awindx = _lgb_get_new_index(buffers[bufref]->awindx); // increment the write index
-    buffers[bufref]->amsgs++; // increment the number of unread messages
-    sem_post(&buffers[bufref]->wlock); // release the lock
+    size_t t_nPadLen = 0;
+    size_t t_nWritePos = atomic_load_explicit(&t_pBuffer->awpos, memory_order_relaxed);
 
-    return 0;
+    while (true) {
+        size_t t_nReadPos = atomic_load_explicit(&t_pBuffer->arpos, memory_order_acquire);
+        ptrdiff_t t_nUsed = (ptrdiff_t) (t_nWritePos - t_nReadPos);
+        if (t_nUsed < 0) {
+            // our copy of the write position is stale
+            t_nWritePos = atomic_load_explicit(&t_pBuffer->awpos, memory_order_relaxed);
+            continue;
+        }
+
+        // a record can't wrap around the end of the buffer; pad out the rest of it instead
+        size_t t_nToEnd = t_pBuffer->m_nCapacity - (t_nWritePos & t_pBuffer->m_nMask);
+        t_nPadLen = (t_nToEnd < t_nRecLen ? t_nToEnd : 0);
+
+        // make sure there's enough free space on the buffer
+        if ((t_nUsed + t_nPadLen + t_nRecLen) > (t_pBuffer->m_nCapacity - t_pBuffer->m_nWarnBytes)) {
+            lgu_warn_msg("there are too many unread messages.");
+            return NULL;
+        }
+
+        if (t_pBuffer->m_bSingleProducer) {
+            // nothing else writes to this buffer; no need to compete for the space
+            atomic_store_explicit(&t_pBuffer->awpos, t_nWritePos + t_nPadLen + t_nRecLen, memory_order_relaxed);
+            break;
+        }
+        else if (atomic_compare_exchange_weak_explicit(
+            &t_pBuffer->awpos,
+            &t_nWritePos,
+            t_nWritePos + t_nPadLen + t_nRecLen,
+            memory_order_relaxed,
+            memory_order_relaxed
+        )) {
+            break;
+        }
+        // another producer claimed the space first; t_nWritePos now holds the new position
+    }
+
+    if (t_nPadLen) {
+        logger_buffer_rec* t_pPad = _lgb_rec_at(t_pBuffer, t_nWritePos);
+        t_pPad->m_nLen = (uint32_t) t_nPadLen;
+        atomic_store_explicit(&t_pPad->m_nState, LOGGER_BUFFER_REC_PAD, memory_order_release);
+        t_nWritePos += t_nPadLen;
+    }
+
+    logger_buffer_rec* t_pRec = _lgb_rec_at(t_pBuffer, t_nWritePos);
+    t_pRec->m_nLen = (uint32_t) t_nRecLen;
+
+    return (t_loggerrec*) (t_pRec + 1);
+}
+
+/*
+ * Makes a message returned by lgb_reserve_message() available to the reader.
+ */
+int lgb_commit_message(int bufref, t_loggerrec* msg) {
+    return _lgb_publish(bufref, msg, LOGGER_BUFFER_REC_MSG);
+}
+
+/*
+ * Gives back a message returned by lgb_reserve_message() without logging it.
+ */
+int lgb_discard_message(int bufref, t_loggerrec* msg) {
+    return _lgb_publish(bufref, msg, LOGGER_BUFFER_REC_DISCARD);
 }
 
 /*
- * Removes a message from the buffer and returns a pointer to it.
+ * Places pointers to up to p_nMax of the oldest messages on the buffer in
+ * p_pMsgs, in the order they were logged. The messages stay in the buffer
+ * until lgb_release_batch() is called; lgb_drop_oldest() waits for that, so
+ * release them as soon as they've been copied or written.
+ *
+ * Only one thread may read from a buffer.
+ *
+ * Returns the number of messages placed in p_pMsgs, or -1 on error.
  */
-t_loggermsg* lgb_read_message(int bufref) {
+int lgb_read_batch(int bufref, t_loggerrec** p_pMsgs, int p_nMax) {
 
     if (_lgb_check_values(bufref))
-        return NULL;
+        return -1;
+    else if ((p_pMsgs == NULL) || (p_nMax < 1)) {
+        lgu_warn_msg("Invalid destination for a batch of messages.");
+        return -1;
+    }
 
-    t_loggermsg* rtn_val = NULL;
+    logger_buffer* t_pBuffer = buffers[bufref];
+    for (int t_nWord = 0; t_nWord < LOGGER_BUFFER_CHILD_WORDS; t_nWord++) {
+        if (atomic_load_explicit(&t_pBuffer->anchildren[t_nWord], memory_order_relaxed) != 0)
+            return _lgb_read_merged(t_pBuffer, p_pMsgs, p_nMax);
+    }
 
-    sem_wait(&buffers[bufref]->rlock); // get the lock
+    _lgb_begin_read(t_pBuffer);
+    size_t t_nPos = atomic_load_explicit(&t_pBuffer->arpos, memory_order_relaxed);
+    int t_nCount = 0;
 
-    if (buffers[bufref]->amsgs == 0) {
-        lgu_warn_msg("there are no unread messages.");
-        sem_post(&buffers[bufref]->rlock);
-        return NULL;
+    // walk the committed records; stop at the first one that isn't done yet
+    while (t_nCount < p_nMax) {
+        logger_buffer_rec* t_pRec = _lgb_rec_at(t_pBuffer, t_nPos);
+        uint32_t t_nState = atomic_load_explicit(&t_pRec->m_nState, memory_order_acquire);
+        if (t_nState == LOGGER_BUFFER_REC_FREE)
+            break;
+        else if (t_nState == LOGGER_BUFFER_REC_MSG)
+            p_pMsgs[t_nCount++] = (t_loggerrec*) (t_pRec + 1);
+        t_nPos += t_pRec->m_nLen;
     }
 
-    int read_index = buffers[bufref]->arindx; // get the current read index
-    rtn_val = buffers[bufref]->messages[read_index]; // get the pointer to the message
-    buffers[bufref]->messages[read_index] = NULL; // remove the message from the buffer
-    buffers[bufref]->arindx = _lgb_get_new_index(buffers[bufref]->arindx); // increment the read index
-    buffers[bufref]->amsgs--; // decrease count of unread messages
-    sem_post(&buffers[bufref]->rlock); // release the lock
+    t_pBuffer->m_nBatchEnd = t_nPos;
+    return t_nCount;
+}
 
-    return rtn_val;
+/*
+ * Frees every record returned by the last call to lgb_read_batch(), along
+ * with any padding or discarded records between them.
+ */
+int lgb_release_batch(int bufref) {
+
+    if (_lgb_check_values(bufref))
+        return 1;
+
+    logger_buffer* t_pBuffer = buffers[bufref];
+    _lgb_release_span(t_pBuffer);
+
+    // release the thread buffers read with this one, and remove any whose thread is gone;
+    // a thread buffer added since the read is left alone
+    int t_nRtn = 0;
+    for (int t_nWord = 0; t_nWord < LOGGER_BUFFER_CHILD_WORDS; t_nWord++) {
+        uint64_t t_nChildren = atomic_load_explicit(&t_pBuffer->anchildren[t_nWord], memory_order_acquire);
+        while (t_nChildren != 0) {
+            int t_nBit = __builtin_ctzll(t_nChildren);
+            t_nChildren &= t_nChildren - 1;
+
+            int t_nChildRef = (t_nWord * 64) + t_nBit;
+            logger_buffer* t_pChild = buffers[t_nChildRef];
+            _lgb_release_span(t_pChild);
+
+            if (atomic_load(&t_pChild->abretired) &&
+                (atomic_load(&t_pChild->arpos) == atomic_load(&t_pChild->awpos))) {
+                atomic_fetch_and(&t_pBuffer->anchildren[t_nWord], ~((uint64_t) 1 << t_nBit));
+                if (lgb_remove_buffer(t_nChildRef))
+                    t_nRtn = 1;
+            }
+        }
+    }
+
+    return t_nRtn;
+}
+
+/*
+ * Frees the oldest message on the buffer, along with any padding or discarded
+ * records in front of it, to make room for a new one. Waits up to
+ * ms_to_wait milliseconds for the reader to finish with the messages it's
+ * holding; those are never dropped. If p_fnDropped isn't NULL, it's called
+ * with each message before it's freed.
+ *
+ * Any thread may call this.
+ *
+ * Returns the number of messages dropped (0 if none could be, because the
+ * buffer is empty or nothing was committed in time), or -1 on error.
+ */
+int lgb_drop_oldest(int bufref, int ms_to_wait, void (*p_fnDropped)(const t_loggerrec*)) {
+
+    if (_lgb_check_values(bufref))
+        return -1;
+
+    logger_buffer* t_pBuffer = buffers[bufref];
+
+    struct timespec t_tsBreak;
+    if (clock_gettime(CLOCK_REALTIME, &t_tsBreak) == -1) {
+        lgu_warn_msg("something went wrong getting the time");
+        return -1;
+    }
+    lgb_add_to_time(&t_tsBreak, ms_to_wait, 0, LOGGER_SLEEP_SECS * 1000);
+
+    while (sem_timedwait(&t_pBuffer->readlock, &t_tsBreak) == -1) {
+        if (errno == ETIMEDOUT)
+            return 0;
+        else if (errno != EINTR) {
+            lgu_warn_msg_int("failed to get the buffer read lock; errno: %d", errno);
+            return -1;
+        }
+    }
+
+    size_t t_nReadPos = atomic_load_explicit(&t_pBuffer->arpos, memory_order_relaxed);
+    int t_nDropped = 0;
+    while (t_nDropped == 0) {
+        logger_buffer_rec* t_pRec = _lgb_rec_at(t_pBuffer, t_nReadPos);
+        uint32_t t_nState = atomic_load_explicit(&t_pRec->m_nState, memory_order_acquire);
+        if (t_nState == LOGGER_BUFFER_REC_FREE) {
+            if (t_nReadPos == atomic_load_explicit(&t_pBuffer->awpos, memory_order_relaxed))
+                break; // the buffer is empty
+
+            // another producer is still writing the oldest message; it won't take long
+            struct timespec t_tsNow;
+            clock_gettime(CLOCK_REALTIME, &t_tsNow);
+            if ((t_tsNow.tv_sec > t_tsBreak.tv_sec) || ((t_tsNow.tv_sec == t_tsBreak.tv_sec) && (t_tsNow.tv_nsec >= t_tsBreak.tv_nsec)))
+                break;
+            sched_yield();
+            continue;
+        }
+        else if (t_nState == LOGGER_BUFFER_REC_MSG) {
+            if (p_fnDropped != NULL)
+                p_fnDropped((const t_loggerrec*) (t_pRec + 1));
+            t_nDropped++;
+        }
+
+        // the reader may be checking the state while it waits, so clear it atomically
+        size_t t_nRecLen = t_pRec->m_nLen;
+        atomic_store_explicit(&t_pRec->m_nState, LOGGER_BUFFER_REC_FREE, memory_order_relaxed);
+        t_pRec->m_nLen = 0;
+        memset(t_pRec + 1, 0, t_nRecLen - sizeof(logger_buffer_rec));
+        t_nReadPos += t_nRecLen;
+    }
+    atomic_store_explicit(&t_pBuffer->arpos, t_nReadPos, memory_order_release);
+
+    sem_post(&t_pBuffer->readlock);
+
+    return t_nDropped;
+}
+
+/*
+ * Waits until the reader frees space on the buffer, or until p_pBreakTime
+ * (CLOCK_REALTIME). Returns right away if a message with p_nDataLen bytes of
+ * data would already fit; the space isn't reserved, so the caller still has to
+ * try lgb_reserve_message() again.
+ *
+ * Returns:
+ * 0  when space was freed
+ * >0 when the wait timed out
+ * <0 when there was an error
+ */
+int lgb_wait_for_space(int bufref, size_t p_nDataLen, const struct timespec* p_pBreakTime) {
+
+    if (_lgb_check_values(bufref))
+        return -1;
+
+    logger_buffer* t_pBuffer = buffers[bufref];
+    size_t t_nRecLen = _lgb_align(sizeof(logger_buffer_rec) + sizeof(t_loggerrec) + p_nDataLen);
+
+    // count ourselves before checking, so the reader wakes us for any space it frees after the check
+    atomic_fetch_add(&t_pBuffer->anspacewaiters, 1);
+    pthread_mutex_lock(&t_pBuffer->spacelock);
+    unsigned long t_nGen = t_pBuffer->m_nSpaceGen;
+
+    int t_nRtn = 0;
+    size_t t_nUsed = atomic_load(&t_pBuffer->awpos) - atomic_load(&t_pBuffer->arpos);
+    if ((t_nUsed + (2 * t_nRecLen)) > (t_pBuffer->m_nCapacity - t_pBuffer->m_nWarnBytes)) {
+        // a record may need as much padding as its own length when the buffer wraps
+        while (t_pBuffer->m_nSpaceGen == t_nGen) {
+            int t_nWaitRtn = pthread_cond_timedwait(&t_pBuffer->spacecond, &t_pBuffer->spacelock, p_pBreakTime);
+            if (t_nWaitRtn == ETIMEDOUT) {
+                t_nRtn = 1;
+                break;
+            }
+            else if (t_nWaitRtn != 0) {
+                lgu_warn_msg_int("failed to wait for space on the buffer; errno: %d", t_nWaitRtn);
+                t_nRtn = -1;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&t_pBuffer->spacelock);
+    atomic_fetch_sub(&t_pBuffer->anspacewaiters, 1);
+
+    return t_nRtn;
+}
+
+/*
+ * Returns how full the buffer is, as a percentage of the space messages can
+ * use, or -1 on error. The value is only a snapshot; producers and the reader
+ * can change it right away.
+ */
+int lgb_get_fill(int bufref) {
+
+    if (_lgb_check_values(bufref))
+        return -1;
+
+    logger_buffer* t_pBuffer = buffers[bufref];
+    size_t t_nUsed = atomic_load_explicit(&t_pBuffer->awpos, memory_order_relaxed)
+        - atomic_load_explicit(&t_pBuffer->arpos, memory_order_relaxed);
+    size_t t_nUsable = t_pBuffer->m_nCapacity - t_pBuffer->m_nWarnBytes;
+    if (t_nUsed >= t_nUsable)
+        return 100;
+
+    return (int) ((t_nUsed * 100) / t_nUsable);
 }
 
 /*
  * Waits for milliseconds_to_wait milliseconds for a message to appear on the buffer.
  *
+ * The reader checks for a message LOGGER_BUFFER_SPIN_COUNT times before it
+ * sleeps on the buffer's semaphore, so an idle logger doesn't use the CPU.
+ *
  * Returns:
  * 0  when there's a message to be read
- * >0 when the wait timed out
+ * >0 when the wait timed out, or lgb_wake() was called
  * <0 when there was an error
  */
 int lgb_wait_for_messages(int bufref, int milliseconds_to_wait) {
@@ -317,41 +1059,77 @@ int lgb_wait_for_messages(int bufref, int milliseconds_to_wait) {
     if (_lgb_check_values(bufref))
         return -1;
 
+    logger_buffer* t_pBuffer = buffers[bufref];
+
     // before doing anything else, check if there's already a message
-    if (buffers[bufref]->amsgs > 0) {
-        return 0;
+    for (int count = 0; count < LOGGER_BUFFER_SPIN_COUNT; count++) {
+        if (_lgb_group_has_message(t_pBuffer))
+            return 0;
+        LOGGER_BUFFER_CPU_RELAX();
     }
 
     // get the current time
     struct timespec break_time;
-    if (clock_gettime(CLOCK_REALTIME, &break_time) == 1) {
+    if (clock_gettime(CLOCK_REALTIME, &break_time) == -1) {
         lgu_warn_msg("something went wrong getting the time");
         return -1;
     }
 
-    // determine the time to break from the loop
+    // determine the time to stop waiting
     lgb_add_to_time(&break_time, milliseconds_to_wait, min_milliseconds_wait, max_milliseconds_wait);
 
-    while(buffers[bufref]->amsgs == 0) {
-        struct timespec loop_time;
-        if (clock_gettime(CLOCK_REALTIME, &loop_time) == 1) {
-            lgu_warn_msg("something went wrong getting the time");
-            return -1;
+    // tell producers we're going to sleep, then check again for anything they added before seeing it
+    atomic_store(&t_pBuffer->abparked, true);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (true) {
+        if (_lgb_group_has_message(t_pBuffer)) {
+            if (_lgb_unpark(t_pBuffer))
+                return -1;
+            return 0;
+        }
+        else if (atomic_exchange(&t_pBuffer->abwake, false)) {
+            if (_lgb_unpark(t_pBuffer))
+                return -1;
+            return 1;
+        }
+
+        if (sem_timedwait(&t_pBuffer->wake, &break_time) == 0) {
+            // the thread that posted cleared abparked; check what woke us
+            if (_lgb_group_has_message(t_pBuffer))
+                return 0;
+            atomic_store(&t_pBuffer->abwake, false);
+            return 1;
+        }
+        else if (errno == EINTR) {
+            continue;
         }
-        // check if we've looped for enough time
-        if (
-            (loop_time.tv_sec >= break_time.tv_sec) &&
-            (loop_time.tv_nsec >= break_time.tv_nsec)
-        ) {
-            return 1; // return 1 to indicate max time elapsed
+        else if (errno == ETIMEDOUT) {
+            if (_lgb_unpark(t_pBuffer))
+                return -1;
+            return (_lgb_group_has_message(t_pBuffer) ? 0 : 1);
+        }
+        else {
+            lgu_warn_msg_int("failed to wait for messages; errno: %d", errno);
+            _lgb_unpark(t_pBuffer);
+            return -1;
         }
     }
+}
 
-    if (buffers[bufref]->amsgs > 0)
-        return 0; // there's at least one message
+/*
+ * Makes the reader return from lgb_wait_for_messages() without waiting for a
+ * message. If the reader isn't waiting, its next wait returns right away.
+ */
+int lgb_wake(int bufref) {
+
+    if (_lgb_check_values(bufref))
+        return 1;
 
-    // we should have returned from the loop above after timing out, so indicate error
-    return -1;
+    atomic_store(&buffers[bufref]->abwake, true);
+    _lgb_wake_reader(buffers[bufref]);
+
+    return 0;
 }
 
 int lgb_add_to_time(struct timespec *p_pTspec, int ms_to_add, int min_ms, int max_ms) {
@@ -385,12 +1163,16 @@ int lgb_add_to_time(struct timespec *p_pTspec, int ms_to_add, int min_ms, int ma
 }
 
 #ifndef NDEBUG
-int logger_get_buffer_size() {
-    return CLOGGER_BUFFER_SIZE;
+size_t logger_get_buffer_size() {
+    return g_nCapacity;
+}
+
+size_t logger_get_buffer_close_warn() {
+    return g_nWarnBytes;
 }
 
-int logger_get_buffer_close_warn() {
-    return BUFFER_CLOSE_WARN;
+size_t logger_get_record_size(size_t p_nDataLen) {
+    return _lgb_align(sizeof(logger_buffer_rec) + sizeof(t_loggerrec) + p_nDataLen);
 }
 #endif
 
@@ -8,31 +8,57 @@ extern "C" {
 
 #include "logger_msg.h"
 
-int lgb_init();
+#include <time.h>
+
+int lgb_init(size_t p_nCapacity, size_t p_nWarnBytes, size_t p_nThreadCapacity);
 
 int lgb_free();
 
 int lgb_create_buffer();
 
+int lgb_create_thread_buffer(int p_nParentRef);
+
+int lgb_retire_buffer(int bufref);
+
 int lgb_remove_buffer(int bufref);
 
-int lgb_add_message(int bufref, t_loggermsg* msg);
+size_t lgb_get_max_data(int bufref);
+
+t_loggerrec* lgb_reserve_message(int bufref, size_t p_nDataLen);
+
+int lgb_commit_message(int bufref, t_loggerrec* msg);
+
+int lgb_discard_message(int bufref, t_loggerrec* msg);
 
-t_loggermsg* lgb_read_message(int bufref);
+int lgb_read_batch(int bufref, t_loggerrec** p_pMsgs, int p_nMax);
 
-int lgb_wait_for_messages(int bufref, int seconds_to_wait);
+int lgb_release_batch(int bufref);
+
+int lgb_drop_oldest(int bufref, int ms_to_wait, void (*p_fnDropped)(const t_loggerrec*));
+
+int lgb_wait_for_space(int bufref, size_t p_nDataLen, const struct timespec* p_pBreakTime);
+
+int lgb_get_fill(int bufref);
+
+int lgb_wait_for_messages(int bufref, int milliseconds_to_wait);
+
+int lgb_wake(int bufref);
 
 int lgb_add_to_time(struct timespec *p_pTspec, int ms_to_add, int min_ms, int max_ms);
 
 #ifndef NDEBUG
 /*!
- * Returns the value of BUFFER_SIZE.
+ * Returns the number of bytes on the logger's buffer, as chosen by
+ * logger_options.buffer_bytes, and the bytes kept free at its end.
  *
- * This function is intended to be used with test functions.
+ * These functions are intended to be used with test functions.
  */
-int logger_get_buffer_size();
+size_t logger_get_buffer_size();
+
+size_t logger_get_buffer_close_warn();
 
-int logger_get_buffer_close_warn();
+// the bytes a message with p_nDataLen bytes of data takes on a buffer
+size_t logger_get_record_size(size_t p_nDataLen);
 #endif
 
 #ifdef __cplusplus
@@ -16,6 +16,11 @@ static const char* lgf_time_only = { "%h:%M:%s" };
 
 // private function declarations
 int _lgf_obj_check(logger_formatter* formatobj);
+static int _lgf_set_levels(logger_formatter* formatobj);
+static int _lgf_update_date(logger_formatter* formatobj, time_t p_Time);
+static void _lgf_write_digits(char* dest, uint64_t value, int digits);
+static int _lgf_count_digits(uint64_t value);
+static int _lgf_add_op(lgf_layout* p_pLayout, int p_nOp, int p_nStart, int p_nLen);
 
 // private function definitions
 int _lgf_obj_check(logger_formatter* formatobj) {
@@ -35,11 +40,87 @@ int _lgf_obj_check(logger_formatter* formatobj) {
     return 0;
 }
 
+int _lgf_set_levels(logger_formatter* formatobj) {
+
+    formatobj->max_level_len = lgl_get_max_len(formatobj->level_code_format);
+    if (formatobj->max_level_len < 0) {
+        lgu_warn_msg("Failed to determine the length of the error codes.");
+        return 1;
+    }
+    else if (formatobj->max_level_len >= FORMATTER_LEVEL_SIZE) {
+        lgu_warn_msg("The level strings are too long.");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Formats the date for the second p_Time and caches it. Expects the lock to
+ * already be held.
+ */
+int _lgf_update_date(logger_formatter* formatobj, time_t p_Time) {
+
+    formatobj->cached_time = -1;
+
+    struct tm t_TimeData;
+    if (localtime_r(&p_Time, &t_TimeData) != &t_TimeData) {
+        lgu_warn_msg("Failed to convert the time of the message.");
+        return 1;
+    }
+
+    // TODO 0 isn't necessarily an error; it _can_ mean error, or it can mean 0 bytes written, which can be valid
+    size_t date_len = strftime(formatobj->cached_date, FORMATTER_DATE_SIZE, formatobj->date_format, &t_TimeData);
+    if (date_len == 0) {
+        // strftime() did not write contents to the string
+        lgu_warn_msg("Failed to format the date and time string.");
+        return 1;
+    }
+
+    formatobj->cached_date_len = date_len;
+    formatobj->cached_time = p_Time;
+
+    return 0;
+}
+
+/*
+ * Writes exactly 'digits' digits of value to dest, padded with zeros.
+ */
+void _lgf_write_digits(char* dest, uint64_t value, int digits) {
+    for (int count = digits - 1; count >= 0; count--) {
+        dest[count] = (char) ('0' + (value % 10));
+        value /= 10;
+    }
+}
+
+int _lgf_count_digits(uint64_t value) {
+    int digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+int _lgf_add_op(lgf_layout* p_pLayout, int p_nOp, int p_nStart, int p_nLen) {
+    if (p_pLayout->m_nOps == FORMATTER_LAYOUT_MAX_OPS) {
+        lgu_warn_msg("The layout has too many parts.");
+        return 1;
+    }
+    lgf_layout_op* t_pOp = &p_pLayout->m_Ops[p_pLayout->m_nOps++];
+    t_pOp->m_nOp = p_nOp;
+    t_pOp->m_nStart = p_nStart;
+    t_pOp->m_nLen = p_nLen;
+    return 0;
+}
+
 // public functions
 int lgf_init(logger_formatter* formatobj) {
 
     formatobj->date_time_enabled = false;
     formatobj->m_cSeperator = FORMATTER_SEP_SPACE;
+    formatobj->subsec_digits = CLOGGER_TIME_SECONDS;
+    formatobj->cached_time = -1;
 
     formatobj->lock = (sem_t*) malloc(sizeof(sem_t));
     sem_init(formatobj->lock, 0, 1);
@@ -52,9 +133,7 @@ int lgf_init(logger_formatter* formatobj) {
     }
 
     formatobj->level_code_format = lgl_ustrs;
-    formatobj->max_level_len = lgl_get_max_len(formatobj->level_code_format);
-    if (formatobj->max_level_len < 0) {
-        lgu_warn_msg("Failed to determine the length of the error codes.");
+    if (_lgf_set_levels(formatobj)) {
         return 1;
     }
 
@@ -92,57 +171,237 @@ int lgf_enable_date(logger_formatter* formatobj, char* p_sDateFormat) {
 }
 */
 
-int lgf_format(logger_formatter* formatobj, char* dest, struct tm *tm, int lglevel) {
+/*
+ * Writes the date of a message to dest. timestamp is the number of
+ * nanoseconds since the epoch; it's converted to local time here so the
+ * thread that logged the message doesn't have to.
+ *
+ * The date is only formatted again when the second changes; otherwise the
+ * output is a memcpy() of the cached date.
+ */
+int lgf_format(logger_formatter* formatobj, char* dest, uint64_t timestamp) {
+
+    static const uint64_t t_nNsPerSec = 1000000000;
+    static const uint64_t t_nFractionDivisors[] = {
+        1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1
+    };
 
     if (_lgf_obj_check(formatobj)) {
-        return 1;
-    }
-    else if (tm == NULL) {
-        lgu_warn_msg("Given an invalid object to format");
-        return 1;
+        return -1;
     }
     else if (dest == NULL) {
         lgu_warn_msg("Destination to place format cannot be null");
-        return 1;
-    }
-    else if (lgl_check(lglevel)) {
-        lgu_warn_msg_int("Log level has invalid range; value: %d", lglevel);
-        return 1;
+        return -1;
     }
 
     // get the lock
     sem_wait(formatobj->lock);
 
-    // create the date/time string
-    char formatted_date[FORMATTER_DATE_SIZE];
-    // TODO 0 isn't necessarily an error; it _can_ mean error, or it can mean 0 bytes written, which can be valid
-    if (strftime(formatted_date, FORMATTER_DATE_SIZE, formatobj->date_format, tm) == 0) {
-        // strftime() did not write contents to the string
-        lgu_warn_msg("Failed to format the date and time string.");
-        sem_post(formatobj->lock);
-        return 1;
+    time_t t_Time = (time_t) (timestamp / t_nNsPerSec);
+    if (t_Time != formatobj->cached_time) {
+        if (_lgf_update_date(formatobj, t_Time)) {
+            sem_post(formatobj->lock);
+            return -1;
+        }
     }
 
-    // get the log level string
-    int len_to_allocate = formatobj->max_level_len + 1;
-    char lvl_str[len_to_allocate];
-    snprintf(lvl_str, len_to_allocate, "%s", formatobj->level_code_format[lglevel]);
-    for (int count = strlen(lvl_str); count < len_to_allocate - 1; count++)
-        lvl_str[count] = ' ';
-    lvl_str[len_to_allocate - 1] = '\0';
+    size_t len = formatobj->cached_date_len;
+    memcpy(dest, formatobj->cached_date, len);
 
-    // put it all together
-    // TODO size below should be variable
-    snprintf(dest, 50, "%s %s ", formatted_date, lvl_str);
+    // add the fraction of a second, truncated to the number of digits wanted
+    int digits = formatobj->subsec_digits;
+    if ((digits > 0) && ((len + digits + 1) < FORMATTER_DATE_SIZE)) {
+        dest[len] = '.';
+        _lgf_write_digits(dest + len + 1, (timestamp % t_nNsPerSec) / t_nFractionDivisors[digits], digits);
+        len += digits + 1;
+    }
+
+    dest[len] = '\0';
 
     sem_post(formatobj->lock);
 
+    return (int) len;
+}
+
+/*
+ * Splits the pattern into text and the values that replace each % sequence.
+ * Text is copied to the layout with any %% collapsed, and the level strings
+ * are padded to the same length.
+ */
+int lgf_compile_layout(lgf_layout* p_pLayout, const char* p_sPattern) {
+
+    if ((p_pLayout == NULL) || (p_sPattern == NULL)) {
+        lgu_warn_msg("Can't compile a layout without a pattern.");
+        return 1;
+    }
+
+    p_pLayout->m_nOps = 0;
+    p_pLayout->m_nTextLen = 0;
+
+    int t_nTextStart = -1;  // where the text being added started, or -1 if there isn't any
+    for (const char* t_pChar = p_sPattern; *t_pChar != '\0'; t_pChar++) {
+
+        int t_nOp = FORMATTER_OP_TEXT;
+        if ((*t_pChar == '%') && (t_pChar[1] != '%')) {
+            switch (*(++t_pChar)) {
+                case 't': t_nOp = FORMATTER_OP_DATE; break;
+                case 'L': t_nOp = FORMATTER_OP_LEVEL; break;
+                case 'i': t_nOp = FORMATTER_OP_ID; break;
+                case 'm': t_nOp = FORMATTER_OP_MSG; break;
+                case 'T': t_nOp = FORMATTER_OP_THREAD; break;
+                case 's': t_nOp = FORMATTER_OP_SOURCE; break;
+                case 'F': t_nOp = FORMATTER_OP_FUNC; break;
+                default:
+                    lgu_warn_msg("Unknown % sequence in the layout.");
+                    return 1;
+            }
+        }
+        else if (*t_pChar == '%') {
+            t_pChar++;  // %% is a literal %
+        }
+
+        if (t_nOp == FORMATTER_OP_TEXT) {
+            if (p_pLayout->m_nTextLen == FORMATTER_LAYOUT_MAX_TEXT) {
+                lgu_warn_msg("The layout has too much text.");
+                return 1;
+            }
+            if (t_nTextStart < 0)
+                t_nTextStart = (int) p_pLayout->m_nTextLen;
+            p_pLayout->m_sText[p_pLayout->m_nTextLen++] = *t_pChar;
+            continue;
+        }
+
+        if ((t_nTextStart >= 0) && _lgf_add_op(p_pLayout, FORMATTER_OP_TEXT, t_nTextStart, (int) p_pLayout->m_nTextLen - t_nTextStart))
+            return 1;
+        t_nTextStart = -1;
+        if (_lgf_add_op(p_pLayout, t_nOp, 0, 0))
+            return 1;
+    }
+    if ((t_nTextStart >= 0) && _lgf_add_op(p_pLayout, FORMATTER_OP_TEXT, t_nTextStart, (int) p_pLayout->m_nTextLen - t_nTextStart))
+        return 1;
+
+    p_pLayout->m_nLevelLen = lgl_get_max_len(lgl_ustrs);
+    for (int level = 0; level <= LOGGER_MAX_LEVEL; level++) {
+        size_t len = strlen(lgl_ustrs[level]);
+        memcpy(p_pLayout->m_sLevels[level], lgl_ustrs[level], len);
+        memset(p_pLayout->m_sLevels[level] + len, ' ', p_pLayout->m_nLevelLen - len);
+    }
+
+    return 0;
+}
+
+int lgf_replace_layout(_Atomic(lgf_layout*)* p_pLayout, const char* p_sPattern) {
+
+    lgf_layout* t_pLayout = (lgf_layout*) malloc(sizeof(lgf_layout));
+    if (t_pLayout == NULL) {
+        lgu_warn_msg("Failed to allocate space for a layout.");
+        return 1;
+    }
+    else if (lgf_compile_layout(t_pLayout, p_sPattern)) {
+        free(t_pLayout);
+        return 1;
+    }
+
+    t_pLayout->m_pReplaced = atomic_load(p_pLayout);
+    atomic_store_explicit(p_pLayout, t_pLayout, memory_order_release);
+
     return 0;
 }
 
+void lgf_free_layout(lgf_layout* p_pLayout) {
+    while (p_pLayout != NULL) {
+        lgf_layout* t_pReplaced = p_pLayout->m_pReplaced;
+        free(p_pLayout);
+        p_pLayout = t_pReplaced;
+    }
+}
+
+size_t lgf_layout_len(const lgf_layout* p_pLayout, const t_loggermsg* p_pMsg) {
+
+    size_t len = p_pLayout->m_nTextLen + 1;  // the text and the newline
+    for (int count = 0; count < p_pLayout->m_nOps; count++) {
+        switch (p_pLayout->m_Ops[count].m_nOp) {
+            case FORMATTER_OP_DATE: len += p_pMsg->m_nDateLen; break;
+            case FORMATTER_OP_LEVEL: len += p_pLayout->m_nLevelLen; break;
+            case FORMATTER_OP_ID: len += p_pMsg->m_nIdLen; break;
+            case FORMATTER_OP_MSG: len += p_pMsg->m_nMsgLen; break;
+            case FORMATTER_OP_THREAD: len += _lgf_count_digits(p_pMsg->m_nThreadId); break;
+            case FORMATTER_OP_SOURCE:
+                if (p_pMsg->m_sFile != NULL)
+                    len += strlen(p_pMsg->m_sFile) + 1 + _lgf_count_digits(p_pMsg->m_nLine);
+                break;
+            case FORMATTER_OP_FUNC:
+                if (p_pMsg->m_sFunc != NULL)
+                    len += strlen(p_pMsg->m_sFunc);
+                break;
+        }
+    }
+    return len;
+}
+
+/*
+ * Runs each step of the layout in turn; nothing but copies and the digits of
+ * numbers are written.
+ */
+char* lgf_render_layout(const lgf_layout* p_pLayout, char* p_pDest, const t_loggermsg* p_pMsg) {
+
+    for (int count = 0; count < p_pLayout->m_nOps; count++) {
+        const lgf_layout_op* t_pOp = &p_pLayout->m_Ops[count];
+        int digits;
+        switch (t_pOp->m_nOp) {
+            case FORMATTER_OP_TEXT:
+                memcpy(p_pDest, p_pLayout->m_sText + t_pOp->m_nStart, t_pOp->m_nLen);
+                p_pDest += t_pOp->m_nLen;
+                break;
+            case FORMATTER_OP_DATE:
+                memcpy(p_pDest, p_pMsg->m_sDate, p_pMsg->m_nDateLen);
+                p_pDest += p_pMsg->m_nDateLen;
+                break;
+            case FORMATTER_OP_LEVEL:
+                memcpy(p_pDest, p_pLayout->m_sLevels[p_pMsg->m_nLogLevel], p_pLayout->m_nLevelLen);
+                p_pDest += p_pLayout->m_nLevelLen;
+                break;
+            case FORMATTER_OP_ID:
+                memcpy(p_pDest, p_pMsg->m_sId, p_pMsg->m_nIdLen);
+                p_pDest += p_pMsg->m_nIdLen;
+                break;
+            case FORMATTER_OP_MSG:
+                memcpy(p_pDest, p_pMsg->m_sMsg, p_pMsg->m_nMsgLen);
+                p_pDest += p_pMsg->m_nMsgLen;
+                break;
+            case FORMATTER_OP_THREAD:
+                digits = _lgf_count_digits(p_pMsg->m_nThreadId);
+                _lgf_write_digits(p_pDest, p_pMsg->m_nThreadId, digits);
+                p_pDest += digits;
+                break;
+            case FORMATTER_OP_SOURCE:
+                if (p_pMsg->m_sFile != NULL) {
+                    size_t len = strlen(p_pMsg->m_sFile);
+                    memcpy(p_pDest, p_pMsg->m_sFile, len);
+                    p_pDest += len;
+                    *p_pDest++ = ':';
+                    digits = _lgf_count_digits(p_pMsg->m_nLine);
+                    _lgf_write_digits(p_pDest, p_pMsg->m_nLine, digits);
+                    p_pDest += digits;
+                }
+                break;
+            case FORMATTER_OP_FUNC:
+                if (p_pMsg->m_sFunc != NULL) {
+                    size_t len = strlen(p_pMsg->m_sFunc);
+                    memcpy(p_pDest, p_pMsg->m_sFunc, len);
+                    p_pDest += len;
+                }
+                break;
+        }
+    }
+
+    *p_pDest++ = '\n';
+    return p_pDest;
+}
+
 int lgf_get_date(char* p_sDate, logger_formatter* formatobj) {
 
-    if ((p_sDate == NULL) || (formatobj == NULL) || (formatobj->date_format == NULL)) {
+    if ((p_sDate == NULL) || (formatobj == NULL)) {
         lgu_warn_msg("Log Formatter is missing required data for the date.");
         return 1;
     }
@@ -202,14 +461,33 @@ int lgf_set_datetime_format(logger_formatter* formatobj, const char* datetime_fo
     int snprintf_rtn = snprintf(formatobj->date_format, FORMATTER_DATE_FORMAT_SIZE, "%s", datetime_format);
     if ((snprintf_rtn >= FORMATTER_DATE_FORMAT_SIZE) || (snprintf_rtn < 0)) {
         lgu_warn_msg("Failed to copy the datetime format into the object.");
+        sem_post(formatobj->lock);
         return 1;
     }
+    formatobj->cached_time = -1; // the cached date used the old format
     sem_post(formatobj->lock);
 
     return 0;
 
 }
 
+int lgf_set_time_precision(logger_formatter* formatobj, int digits) {
+
+    if (_lgf_obj_check(formatobj)) {
+        return 1;
+    }
+    else if ((digits < CLOGGER_TIME_SECONDS) || (digits > CLOGGER_TIME_NANOSECONDS)) {
+        lgu_warn_msg_int("Time precision must be between 0 and 9 digits; value: %d", digits);
+        return 1;
+    }
+
+    sem_wait(formatobj->lock);
+    formatobj->subsec_digits = digits;
+    sem_post(formatobj->lock);
+
+    return 0;
+}
+
 /*
  * TODO implement or remove functions
 int lgf_get_format_no_date(char* p_sString, logger_formatter* formatobj) {
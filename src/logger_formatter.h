@@ -7,19 +7,36 @@ extern "C" {
 #endif
 
 #include "clogger.h"
+#include "logger_msg.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <semaphore.h>
+#include <stdint.h>
 #include <time.h>
 
 #define FORMATTER_DATE_SIZE 30
 #define FORMATTER_DATE_FORMAT_SIZE 40
 
+#define FORMATTER_LEVEL_SIZE 16
+
 #define FORMATTER_MAX_TOTAL_SIZE FORMATTER_DATE_SIZE
 
+// the layout handlers use until they're given another one
+#define FORMATTER_DEFAULT_LAYOUT "%t %L %i %m"
+
+// limits on the pattern of a layout
+#define FORMATTER_LAYOUT_MAX_OPS 32
+#define FORMATTER_LAYOUT_MAX_TEXT 128
+
 #define FORMATTER_SEP_BRACKET   '['
 #define FORMATTER_SEP_SPACE     ' '
 
+/*
+ * The date only changes once a second, so the formatted date for the second
+ * of the last message is kept in cached_date; cached_time is -1 when there's
+ * nothing cached.
+ */
 typedef struct {
     bool            date_time_enabled;
     char            date_format[FORMATTER_DATE_FORMAT_SIZE];
@@ -28,8 +45,46 @@ typedef struct {
     char            m_cSeperator;
     int             max_level_len;
     int             obj_not_init;
+    int             subsec_digits;
+    time_t          cached_time;
+    char            cached_date[FORMATTER_DATE_SIZE];
+    size_t          cached_date_len;
 } logger_formatter;
 
+// what each step of a layout writes
+#define FORMATTER_OP_TEXT       0   // text from the pattern
+#define FORMATTER_OP_DATE       1   // %t
+#define FORMATTER_OP_LEVEL      2   // %L
+#define FORMATTER_OP_ID         3   // %i
+#define FORMATTER_OP_MSG        4   // %m
+#define FORMATTER_OP_THREAD     5   // %T
+#define FORMATTER_OP_SOURCE     6   // %s, file:line
+#define FORMATTER_OP_FUNC       7   // %F
+
+typedef struct {
+    int m_nOp;
+    int m_nStart;   // where FORMATTER_OP_TEXT's text is in m_sText
+    int m_nLen;
+} lgf_layout_op;
+
+/*
+ * A pattern like "%t %L [%i] %m", compiled by lgf_compile_layout() into the
+ * steps that write each line so nothing is parsed per message. The levels are
+ * padded to the same length once, in m_sLevels.
+ *
+ * A handler's thread may still be using a layout when it's replaced, so the
+ * layout it replaced is kept in m_pReplaced until the handler is freed.
+ */
+typedef struct lgf_layout {
+    lgf_layout_op   m_Ops[FORMATTER_LAYOUT_MAX_OPS];
+    int             m_nOps;
+    char            m_sText[FORMATTER_LAYOUT_MAX_TEXT];
+    size_t          m_nTextLen;     // total length of the text steps
+    char            m_sLevels[LOGGER_MAX_LEVEL + 1][FORMATTER_LEVEL_SIZE];
+    int             m_nLevelLen;
+    struct lgf_layout* m_pReplaced;
+} lgf_layout;
+
 // TODO implement or remove items below
 //extern const char* lgf_date_only;
 //extern const char* lgf_time_only;
@@ -38,12 +93,44 @@ typedef struct {
 int lgf_init(logger_formatter* formatobj);
 int lgf_free(logger_formatter* formatobj);
 
-int lgf_format(logger_formatter* formatobj, char* dest, struct tm *tm, int lglevel);
+/*
+ * dest must have room for FORMATTER_DATE_SIZE characters. Returns the
+ * number of characters written, not counting the null character, or -1 on
+ * error.
+ */
+int lgf_format(logger_formatter* formatobj, char* dest, uint64_t timestamp);
+
+/*
+ * Compiles p_sPattern into p_pLayout. Returns 0 on success, or 1 if the
+ * pattern has an unknown % sequence or is too long.
+ */
+int lgf_compile_layout(lgf_layout* p_pLayout, const char* p_sPattern);
+
+/*
+ * Compiles p_sPattern into a new layout and makes it the one p_pLayout points
+ * to. Returns 0 on success.
+ */
+int lgf_replace_layout(_Atomic(lgf_layout*)* p_pLayout, const char* p_sPattern);
+
+// frees a layout and every layout it replaced
+void lgf_free_layout(lgf_layout* p_pLayout);
+
+// returns the number of characters lgf_render_layout() writes for p_pMsg
+size_t lgf_layout_len(const lgf_layout* p_pLayout, const t_loggermsg* p_pMsg);
+
+/*
+ * Writes p_pMsg to p_pDest using the layout, followed by a newline. p_pDest
+ * needs room for lgf_layout_len() characters; nothing is null-terminated.
+ *
+ * Returns the end of what was written.
+ */
+char* lgf_render_layout(const lgf_layout* p_pLayout, char* p_pDest, const t_loggermsg* p_pMsg);
 
 int lgf_set_date_only(logger_formatter* formatobj);
 int lgf_set_datetime_format(logger_formatter* formatobj, const char* datetime_format);
 int lgf_set_no_datetime(logger_formatter* formatobj);
 int lgf_set_time_only(logger_formatter* formatobj);
+int lgf_set_time_precision(logger_formatter* formatobj, int digits);
 
 
 /*
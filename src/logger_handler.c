@@ -1,19 +1,73 @@
 
 #include "logger_handler.h"
 
+#include "logger_buffer.h"
+
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <semaphore.h>
 #include <string.h> //memset()
+#include <time.h>
+
+// most messages a handler thread writes at once
+#define LGH_WORKER_BATCH_SIZE 64
+
+// how long a handler thread waits for messages before checking if it should stop
+#define LGH_WORKER_WAIT_MS 1000
+
+// how often a handler thread holding messages checks if it should write them
+#define LGH_WORKER_FLUSH_CHECK_MS 50
+
+// how often a handler thread tries to open its handler again after it failed to
+#define LGH_WORKER_OPEN_RETRY_MS 1000
+
+// messages picked out of a batch for one handler are written this many at a time
+#define LGH_ROUTE_BATCH_SIZE 64
+
+/*
+ * A handler with its own thread. The logger thread copies each message to
+ * the handler's buffer, and the handler's thread is the only one that calls
+ * the handler's functions until it's stopped, so a slow handler only holds
+ * up its own messages. When its buffer is full, or the handler can't be
+ * opened, the handler's messages are dropped and counted.
+ *
+ * The thread posts m_semOpened once it has first tried to open the handler,
+ * with the result in m_nOpenRtn.
+ */
+typedef struct {
+    log_handler*    m_pHandler;
+    int             m_nBufRef;      // -1 until the thread is started
+    pthread_t       m_thread;
+    sem_t           m_semOpened;
+    int             m_nOpenRtn;
+    atomic_bool     m_bStop;
+    atomic_ulong    m_nDropped;
+} lgh_worker;
 
 // file global vars
 static log_handler** g_pHandlers = { NULL };
+static lgh_worker** g_pWorkers = { NULL };  // NULL for handlers written by the logger thread
 static sem_t*       g_pStorageSem = { NULL };
 static atomic_bool  g_bInit = { false };
 static atomic_int   g_nHandlers = { 0 };
+static atomic_uint  g_nHandlerMask = { 0 };  // bit n is set while there's a handler at index n
+static atomic_bool  g_bThreaded = { false };
+static atomic_ulong g_nDropped = { 0 };     // dropped by every handler and handler thread, including removed ones
+static atomic_ulong g_nUnrouted = { 0 };    // logged with an ID whose handlers don't exist
 
 // private function declarations
 int _lgh_check_init();
+static int _lgh_destroy_handler(int p_nIndex);
+static int _lgh_start_worker(lgh_worker* p_pWorker);
+static void _lgh_stop_worker(lgh_worker* p_pWorker);
+static void* _lgh_worker_run(void* p_pData);
+static void _lgh_worker_drop(lgh_worker* p_pWorker, unsigned long p_nCount);
+static uint64_t _lgh_now_ms();
+static void _lgh_worker_write(lgh_worker* p_pWorker, const t_loggermsg** p_pMsgs, int p_nCount);
+static void _lgh_worker_view(const t_loggerrec* p_pRec, t_loggermsg* p_pMsg);
+static int _lgh_write_handler(log_handler* p_pHandler, const t_loggermsg** p_pMsgs, int p_nCount);
+static int _lgh_deliver(int p_nIndex, const t_loggermsg** p_pMsgs, int p_nCount);
 
 // private function definitions
 int _lgh_check_init() {
@@ -30,6 +84,300 @@ int _lgh_check_init() {
     return 0;
 }
 
+/*
+ * Stops the handler's thread if it has one, closes the handler if it's open,
+ * then frees it and its context. Expects the storage lock to already be held.
+ *
+ * Returns non-zero if the handler failed to close.
+ */
+int _lgh_destroy_handler(int p_nIndex) {
+    log_handler* t_pHandler = g_pHandlers[p_nIndex];
+
+    if (g_pWorkers[p_nIndex] != NULL) {
+        _lgh_stop_worker(g_pWorkers[p_nIndex]);
+        free(g_pWorkers[p_nIndex]);
+        g_pWorkers[p_nIndex] = NULL;
+    }
+
+    int t_nRtn = 0;
+    if (t_pHandler->isOpen(t_pHandler->m_pContext)) {
+        t_nRtn = t_pHandler->close(t_pHandler->m_pContext);
+    }
+    if (t_pHandler->freeContext != NULL) {
+        t_pHandler->freeContext(t_pHandler->m_pContext);
+    }
+    free(t_pHandler);
+    g_pHandlers[p_nIndex] = NULL;
+    atomic_fetch_and(&g_nHandlerMask, ~CLOGGER_HANDLER(p_nIndex));
+    return t_nRtn;
+}
+
+/*
+ * Gives a batch to the handler in one call if it supports it, one message at a
+ * time otherwise.
+ *
+ * Returns the number of failed writes.
+ */
+int _lgh_write_handler(log_handler* p_pHandler, const t_loggermsg** p_pMsgs, int p_nCount) {
+    int t_nFailed = 0;
+    if (p_pHandler->write_batch != NULL) {
+        t_nFailed = p_pHandler->write_batch(p_pHandler->m_pContext, p_pMsgs, p_nCount);
+    }
+    else {
+        // the handler can't take a batch; give it one message at a time
+        for (int t_nMsg = 0; t_nMsg < p_nCount; t_nMsg++) {
+            if (p_pHandler->write(p_pHandler->m_pContext, p_pMsgs[t_nMsg]))
+                t_nFailed++;
+        }
+    }
+    return t_nFailed;
+}
+
+/*
+ * Gives a batch to the handler at p_nIndex, or to its thread. Expects the
+ * storage lock to be held.
+ *
+ * Returns 0 if the handler took the messages, non-zero if it's closed or
+ * failed to write them. Messages for a closed handler are counted as dropped.
+ */
+int _lgh_deliver(int p_nIndex, const t_loggermsg** p_pMsgs, int p_nCount) {
+    log_handler* t_pHandler = g_pHandlers[p_nIndex];
+    lgh_worker* t_pWorker = g_pWorkers[p_nIndex];
+    if (t_pWorker != NULL) {
+        // the handler's own thread writes it; just hand over a copy
+        if (t_pWorker->m_nBufRef < 0)
+            return 1;
+        _lgh_worker_write(t_pWorker, p_pMsgs, p_nCount);
+        return 0;
+    }
+    else if (t_pHandler == NULL) {
+        return 1;
+    }
+    else if (!t_pHandler->isOpen(t_pHandler->m_pContext)) {
+        // the handler failed to open; the logger thread will try again
+        lgh_add_dropped((unsigned long) p_nCount);
+        return 1;
+    }
+
+    if (_lgh_write_handler(t_pHandler, p_pMsgs, p_nCount)) {
+        lgu_warn_msg_int("failed to write to open handler at reference %d", p_nIndex);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Creates the buffer for a handler's thread and starts it. The thread opens
+ * the handler itself; this waits for it to try so the result can be returned.
+ *
+ * Returns non-zero if the thread couldn't be started or failed to open the
+ * handler. In the latter case the thread keeps running and tries again later.
+ */
+int _lgh_start_worker(lgh_worker* p_pWorker) {
+    p_pWorker->m_nBufRef = lgb_create_buffer();
+    if (p_pWorker->m_nBufRef < 0) {
+        lgu_warn_msg("failed to create the buffer for a handler thread");
+        return 1;
+    }
+
+    sem_init(&p_pWorker->m_semOpened, 0, 0);
+    if (pthread_create(&p_pWorker->m_thread, NULL, &_lgh_worker_run, p_pWorker)) {
+        lgu_warn_msg("failed to start a handler thread");
+        sem_destroy(&p_pWorker->m_semOpened);
+        lgb_remove_buffer(p_pWorker->m_nBufRef);
+        p_pWorker->m_nBufRef = -1;
+        return 1;
+    }
+
+    while (sem_wait(&p_pWorker->m_semOpened) != 0)
+        ;   // interrupted by a signal
+    sem_destroy(&p_pWorker->m_semOpened);
+
+    return p_pWorker->m_nOpenRtn;
+}
+
+/*
+ * Tells a handler's thread to write what's left on its buffer and exit, then
+ * waits for it.
+ */
+void _lgh_stop_worker(lgh_worker* p_pWorker) {
+    if (p_pWorker->m_nBufRef < 0)
+        return;
+
+    atomic_store(&p_pWorker->m_bStop, true);
+    lgb_wake(p_pWorker->m_nBufRef);
+    pthread_join(p_pWorker->m_thread, NULL);
+
+    unsigned long t_nDropped = atomic_load(&p_pWorker->m_nDropped);
+    if (t_nDropped > 0) {
+        lgu_warn_msg_int("a handler thread couldn't write '%d' messages; they were dropped", (int) t_nDropped);
+    }
+
+    lgb_remove_buffer(p_pWorker->m_nBufRef);
+    p_pWorker->m_nBufRef = -1;
+}
+
+/*
+ * Copies a batch of messages, which are ready to be written, to a handler's
+ * buffer. Each record holds its own date, ID and text, one after the other
+ * and each ending with '\0', so they stay valid after the logger thread moves
+ * on. Where the message was logged goes in front of them, when it's known.
+ */
+void _lgh_worker_write(lgh_worker* p_pWorker, const t_loggermsg** p_pMsgs, int p_nCount) {
+
+    for (int t_nMsg = 0; t_nMsg < p_nCount; t_nMsg++) {
+        const t_loggermsg* t_pMsg = p_pMsgs[t_nMsg];
+        size_t t_nSrcLen = (t_pMsg->m_sFile != NULL ? sizeof(t_loggersrc) : 0);
+        size_t t_nDateLen = (size_t) t_pMsg->m_nDateLen;
+        size_t t_nIdLen = (size_t) t_pMsg->m_nIdLen;
+        size_t t_nDataLen = t_nSrcLen + t_nDateLen + 1 + t_nIdLen + 1 + t_pMsg->m_nMsgLen + 1;
+
+        t_loggerrec* t_pCopy = lgb_reserve_message(p_pWorker->m_nBufRef, t_nDataLen);
+        if (t_pCopy == NULL) {
+            _lgh_worker_drop(p_pWorker, 1);
+            continue;
+        }
+
+        char* t_pData = t_pCopy->m_pData;
+        t_pCopy->m_nFlags = 0;
+        if (t_nSrcLen > 0) {
+            t_loggersrc t_Src = { t_pMsg->m_sFile, t_pMsg->m_sFunc };
+            memcpy(t_pData, &t_Src, sizeof(t_loggersrc));
+            t_pCopy->m_nFlags |= LOGGER_REC_HAS_SOURCE;
+            t_pData += t_nSrcLen;
+        }
+        memcpy(t_pData, t_pMsg->m_sDate, t_nDateLen);
+        t_pData[t_nDateLen] = '\0';
+        t_pData += t_nDateLen + 1;
+        memcpy(t_pData, t_pMsg->m_sId, t_nIdLen);
+        t_pData[t_nIdLen] = '\0';
+        t_pData += t_nIdLen + 1;
+        memcpy(t_pData, t_pMsg->m_sMsg, t_pMsg->m_nMsgLen);
+        t_pData[t_pMsg->m_nMsgLen] = '\0';
+
+        t_pCopy->m_sMsgFormat = NULL;
+        t_pCopy->m_nTimestamp = t_pMsg->m_nTimestamp;
+        t_pCopy->m_nDataLen = (uint32_t) t_nDataLen;
+        t_pCopy->m_nId = t_pMsg->m_nId;
+        t_pCopy->m_nHandlers = t_pMsg->m_nHandlers;
+        t_pCopy->m_nThreadId = t_pMsg->m_nThreadId;
+        t_pCopy->m_nLine = t_pMsg->m_nLine;
+        t_pCopy->m_nLogLevel = (uint16_t) t_pMsg->m_nLogLevel;
+
+        lgb_commit_message(p_pWorker->m_nBufRef, t_pCopy);
+    }
+}
+
+// points p_pMsg at the parts of a record copied by _lgh_worker_write()
+void _lgh_worker_view(const t_loggerrec* p_pRec, t_loggermsg* p_pMsg) {
+
+    const char* t_pData = p_pRec->m_pData;
+    const char* t_pEnd = p_pRec->m_pData + p_pRec->m_nDataLen;
+    p_pMsg->m_sFile = NULL;
+    p_pMsg->m_sFunc = NULL;
+    if (p_pRec->m_nFlags & LOGGER_REC_HAS_SOURCE) {
+        t_loggersrc t_Src;
+        memcpy(&t_Src, t_pData, sizeof(t_loggersrc));
+        p_pMsg->m_sFile = t_Src.m_sFile;
+        p_pMsg->m_sFunc = t_Src.m_sFunc;
+        t_pData += sizeof(t_loggersrc);
+    }
+
+    p_pMsg->m_sDate = t_pData;
+    p_pMsg->m_nDateLen = (int) strlen(t_pData);
+    t_pData += p_pMsg->m_nDateLen + 1;
+    p_pMsg->m_sId = t_pData;
+    p_pMsg->m_nIdLen = (int) strlen(t_pData);
+    t_pData += p_pMsg->m_nIdLen + 1;
+    // the text can hold a '\0' of its own, so its length comes from the record's
+    p_pMsg->m_sMsg = t_pData;
+    p_pMsg->m_nMsgLen = (int) (t_pEnd - t_pData) - 1;
+
+    p_pMsg->m_nLogLevel = p_pRec->m_nLogLevel;
+    p_pMsg->m_nId = p_pRec->m_nId;
+    p_pMsg->m_nHandlers = p_pRec->m_nHandlers;
+    p_pMsg->m_nTimestamp = p_pRec->m_nTimestamp;
+    p_pMsg->m_nLine = p_pRec->m_nLine;
+    p_pMsg->m_nThreadId = p_pRec->m_nThreadId;
+}
+
+// counts messages a handler thread gave up on
+void _lgh_worker_drop(lgh_worker* p_pWorker, unsigned long p_nCount) {
+    atomic_fetch_add_explicit(&p_pWorker->m_nDropped, p_nCount, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_nDropped, p_nCount, memory_order_relaxed);
+}
+
+uint64_t _lgh_now_ms() {
+    struct timespec t_Now;
+    clock_gettime(CLOCK_MONOTONIC, &t_Now);
+    return ((uint64_t) t_Now.tv_sec * 1000) + (t_Now.tv_nsec / 1000000);
+}
+
+void* _lgh_worker_run(void* p_pData) {
+
+    lgh_worker* t_pWorker = (lgh_worker*) p_pData;
+    log_handler* t_pHandler = t_pWorker->m_pHandler;
+    int t_nBufRef = t_pWorker->m_nBufRef;
+
+    bool t_bOpen = (t_pHandler->open(t_pHandler->m_pContext) == 0);
+    uint64_t t_nLastOpenMs = _lgh_now_ms();
+    t_pWorker->m_nOpenRtn = (t_bOpen ? 0 : 1);
+    sem_post(&t_pWorker->m_semOpened);
+    if (!t_bOpen) {
+        // keep emptying the buffer so the handler's messages are dropped, not queued
+        lgu_warn_msg("a handler thread failed to open its handler; it will try again");
+    }
+
+    bool t_bWaiting = false; // the handler is holding messages to write later
+    t_loggerrec* t_pRecs[LGH_WORKER_BATCH_SIZE];
+    t_loggermsg t_Msgs[LGH_WORKER_BATCH_SIZE];
+    const t_loggermsg* t_pMsgs[LGH_WORKER_BATCH_SIZE];
+    while (true) {
+        bool t_bStop = atomic_load(&t_pWorker->m_bStop);
+        int t_nWaitMs = LGH_WORKER_WAIT_MS;
+        if (t_bStop)
+            t_nWaitMs = 1;
+        else if (t_bWaiting)
+            t_nWaitMs = LGH_WORKER_FLUSH_CHECK_MS;
+
+        int t_nWaitRtn = lgb_wait_for_messages(t_nBufRef, t_nWaitMs);
+        if (t_nWaitRtn == 0) {
+            int t_nCount = lgb_read_batch(t_nBufRef, t_pRecs, LGH_WORKER_BATCH_SIZE);
+            if ((t_nCount > 0) && !t_bOpen && ((_lgh_now_ms() - t_nLastOpenMs) >= LGH_WORKER_OPEN_RETRY_MS)) {
+                t_bOpen = (t_pHandler->open(t_pHandler->m_pContext) == 0);
+                t_nLastOpenMs = _lgh_now_ms();
+            }
+
+            if ((t_nCount > 0) && t_bOpen) {
+                for (int t_nMsg = 0; t_nMsg < t_nCount; t_nMsg++) {
+                    _lgh_worker_view(t_pRecs[t_nMsg], &t_Msgs[t_nMsg]);
+                    t_pMsgs[t_nMsg] = &t_Msgs[t_nMsg];
+                }
+                if (_lgh_write_handler(t_pHandler, t_pMsgs, t_nCount)) {
+                    lgu_warn_msg("a handler thread failed to write to its handler");
+                }
+            }
+            else if (t_nCount > 0) {
+                _lgh_worker_drop(t_pWorker, (unsigned long) t_nCount);
+            }
+            lgb_release_batch(t_nBufRef);
+        }
+        else if (t_nWaitRtn < 0) {
+            lgu_warn_msg("a handler thread failed to wait for messages");
+            break;
+        }
+        else if (t_bStop) {
+            // the buffer is empty and we've been told to stop
+            break;
+        }
+
+        if (t_bOpen && (t_pHandler->flush != NULL))
+            t_bWaiting = (t_pHandler->flush(t_pHandler->m_pContext, false) > 0);
+    }
+
+    return NULL;
+}
+
 // public functions
 int lgh_init() {
 
@@ -45,8 +393,15 @@ int lgh_init() {
         return 1;
     }
 
+    g_pWorkers = (lgh_worker**)malloc(sizeof(lgh_worker*) * CLOGGER_MAX_NUM_HANDLERS);
+    if (g_pWorkers == NULL) {
+        lgu_warn_msg("failed to allocate space for the handler threads");
+        return 1;
+    }
+
     for (int t_nCount = 0; t_nCount < CLOGGER_MAX_NUM_HANDLERS; t_nCount++) {
         g_pHandlers[t_nCount] = NULL;
+        g_pWorkers[t_nCount] = NULL;
     }
 
     // allocate space for the semaphore
@@ -56,6 +411,7 @@ int lgh_init() {
         return 1;
     }
     g_nHandlers = 0;
+    g_nHandlerMask = 0;
     sem_init(g_pStorageSem, 0, 1);
 
     g_bInit = true;
@@ -84,11 +440,13 @@ int lgh_free() {
     else {
         for (int t_nCount = 0; t_nCount < CLOGGER_MAX_NUM_HANDLERS; t_nCount++) {
             if (g_pHandlers[t_nCount] != NULL) {
-                free(g_pHandlers[t_nCount]);
+                _lgh_destroy_handler(t_nCount);
             }
         }
         free(g_pHandlers);
         g_pHandlers = NULL;
+        free(g_pWorkers);
+        g_pWorkers = NULL;
     }
 
     g_nHandlers = 0;
@@ -100,13 +458,20 @@ int lgh_free() {
     return 0;
 }
 
+/*
+ * Copies p_pHandler into the list of handlers. The handler's context is owned
+ * by the list from here on, and is freed even if the handler can't be added.
+ */
 int lgh_add_handler(const log_handler* p_pHandler) {
 
     if (_lgh_check_init()) {
+        if (p_pHandler->freeContext != NULL)
+            p_pHandler->freeContext(p_pHandler->m_pContext);
         return -1;
     }
 
     int t_nHandlerIndex = 0;
+    bool t_bAdded = false;
     sem_wait(g_pStorageSem); // get the storage lock
 
     for (t_nHandlerIndex = 0; t_nHandlerIndex < CLOGGER_MAX_NUM_HANDLERS; t_nHandlerIndex++) {
@@ -120,21 +485,72 @@ int lgh_add_handler(const log_handler* p_pHandler) {
             }
             // use memcpy to set due to const ptrs
             memcpy(g_pHandlers[t_nHandlerIndex], p_pHandler, sizeof(log_handler));
+
+            if (atomic_load(&g_bThreaded)) {
+                // the thread is started when the handlers are opened
+                lgh_worker* t_pWorker = (lgh_worker*)malloc(sizeof(lgh_worker));
+                if (t_pWorker == NULL) {
+                    lgu_warn_msg("failed to allocate space for handler thread");
+                    free(g_pHandlers[t_nHandlerIndex]);
+                    g_pHandlers[t_nHandlerIndex] = NULL;
+                    break;
+                }
+                t_pWorker->m_pHandler = g_pHandlers[t_nHandlerIndex];
+                t_pWorker->m_nBufRef = -1;
+                atomic_init(&t_pWorker->m_bStop, false);
+                atomic_init(&t_pWorker->m_nDropped, 0);
+                g_pWorkers[t_nHandlerIndex] = t_pWorker;
+            }
+
             g_nHandlers++;
+            atomic_fetch_or(&g_nHandlerMask, CLOGGER_HANDLER(t_nHandlerIndex));
+            t_bAdded = true;
             break;
         }
     }
 
     sem_post(g_pStorageSem);
 
-    if (t_nHandlerIndex >= CLOGGER_MAX_NUM_HANDLERS) return -1;
+    if (!t_bAdded) {
+        // nothing else will free the context of a handler that wasn't added
+        if (p_pHandler->freeContext != NULL)
+            p_pHandler->freeContext(p_pHandler->m_pContext);
+        return -1;
+    }
     else return t_nHandlerIndex;
 }
 
+void lgh_set_threaded(bool p_bThreaded) {
+    atomic_store(&g_bThreaded, p_bThreaded);
+}
+
+unsigned long lgh_get_dropped() {
+    return atomic_load_explicit(&g_nDropped, memory_order_relaxed);
+}
+
+// for handlers to count messages they had to give up on
+void lgh_add_dropped(unsigned long p_nCount) {
+    atomic_fetch_add_explicit(&g_nDropped, p_nCount, memory_order_relaxed);
+}
+
 int lgh_get_num_handlers() {
     return g_nHandlers;
 }
 
+// bit n is set when there's a handler at index n
+unsigned int lgh_get_handler_mask() {
+    return atomic_load_explicit(&g_nHandlerMask, memory_order_relaxed);
+}
+
+unsigned long lgh_get_unrouted() {
+    return atomic_load_explicit(&g_nUnrouted, memory_order_relaxed);
+}
+
+// counts messages that aren't written because none of their handlers exist
+void lgh_add_unrouted(unsigned long p_nCount) {
+    atomic_fetch_add_explicit(&g_nUnrouted, p_nCount, memory_order_relaxed);
+}
+
 int lgh_open_handlers() {
     if (_lgh_check_init()) {
         return 1;
@@ -145,11 +561,22 @@ int lgh_open_handlers() {
     // TODO this code might not be fully thread-safe, but we're going to check
     // for handlers that aren't open before grabbing the lock
     for (int t_nCount = 0; t_nCount < CLOGGER_MAX_NUM_HANDLERS; t_nCount++) {
-        if (g_pHandlers[t_nCount] != NULL) {
-            if (!g_pHandlers[t_nCount]->isOpen()) {
+        if ((g_pHandlers[t_nCount] != NULL) && (g_pWorkers[t_nCount] != NULL)) {
+            // a handler with its own thread is opened by that thread
+            sem_wait(g_pStorageSem); // get the storage lock
+            if ((g_pWorkers[t_nCount] != NULL) && (g_pWorkers[t_nCount]->m_nBufRef < 0)) {
+                // also fails if the thread couldn't open the handler
+                if (_lgh_start_worker(g_pWorkers[t_nCount])) {
+                    t_nRtn++;
+                }
+            }
+            sem_post(g_pStorageSem);
+        }
+        else if (g_pHandlers[t_nCount] != NULL) {
+            if (!g_pHandlers[t_nCount]->isOpen(g_pHandlers[t_nCount]->m_pContext)) {
                 // now grab the lock TODO might be too late for thread safety
                 sem_wait(g_pStorageSem); // get the storage lock
-                if (g_pHandlers[t_nCount]->open()) {
+                if (g_pHandlers[t_nCount]->open(g_pHandlers[t_nCount]->m_pContext)) {
                     // failed to open a handler
                     t_nRtn++;
                 }
@@ -180,14 +607,10 @@ int lgh_remove_all_handlers() {
 
     for (int t_nCount = 0; t_nCount < CLOGGER_MAX_NUM_HANDLERS; t_nCount++) {
         if (g_pHandlers[t_nCount] != NULL) {
-            if (g_pHandlers[t_nCount]->isOpen()) {
-                if (g_pHandlers[t_nCount]->close()) {
-                    // failed to close a handler
-                    t_nRtn++;
-                }
+            if (_lgh_destroy_handler(t_nCount)) {
+                // failed to close a handler
+                t_nRtn++;
             }
-            free(g_pHandlers[t_nCount]);
-            g_pHandlers[t_nCount] = NULL;
             g_nHandlers--;
         }
     }
@@ -212,13 +635,8 @@ int lgh_remove_handler(t_handlerref p_refIndex) {
 
     // TODO if each handler gets its own read/write lock, this won't be needed
     sem_wait(g_pStorageSem); // get the storage lock
-    if (g_pHandlers[p_refIndex]->isOpen()) {
-        // close the handler
-        g_pHandlers[p_refIndex]->close();
-    }
-    // free the memory for the handler
-    free(g_pHandlers[p_refIndex]);
-    g_pHandlers[p_refIndex] = NULL;
+    // close the handler and free the memory for it
+    _lgh_destroy_handler(p_refIndex);
     g_nHandlers--;
     if (g_nHandlers < 0) g_nHandlers = 0;
     sem_post(g_pStorageSem);
@@ -226,6 +644,61 @@ int lgh_remove_handler(t_handlerref p_refIndex) {
     return 0;
 }
 
+int lgh_set_format(t_handlerref p_refIndex, int p_nFormat) {
+    if (_lgh_check_init()) {
+        return 1;
+    }
+    else if (p_refIndex >= CLOGGER_MAX_NUM_HANDLERS) {
+        lgu_warn_msg("index of handler to change is too large");
+        return 1;
+    }
+
+    int t_nRtn = 1;
+    sem_wait(g_pStorageSem); // get the storage lock
+    log_handler* t_pHandler = g_pHandlers[p_refIndex];
+    if (t_pHandler == NULL) {
+        lgu_warn_msg("can't change the format of a handler that hasn't been set");
+    }
+    else if ((t_pHandler->set_format == NULL) || t_pHandler->set_format(t_pHandler->m_pContext, p_nFormat)) {
+        lgu_warn_msg_int("handler doesn't support format %d", p_nFormat);
+    }
+    else {
+        t_nRtn = 0;
+    }
+    sem_post(g_pStorageSem);
+
+    return t_nRtn;
+}
+
+int lgh_set_layout(t_handlerref p_refIndex, const char* p_sPattern) {
+    if (_lgh_check_init()) {
+        return 1;
+    }
+    else if (p_refIndex >= CLOGGER_MAX_NUM_HANDLERS) {
+        lgu_warn_msg("index of handler to change is too large");
+        return 1;
+    }
+
+    int t_nRtn = 1;
+    sem_wait(g_pStorageSem); // get the storage lock
+    log_handler* t_pHandler = g_pHandlers[p_refIndex];
+    if (t_pHandler == NULL) {
+        lgu_warn_msg("can't change the layout of a handler that hasn't been set");
+    }
+    else if (t_pHandler->set_layout == NULL) {
+        lgu_warn_msg("handler doesn't support layouts");
+    }
+    else if (t_pHandler->set_layout(t_pHandler->m_pContext, p_sPattern)) {
+        lgu_warn_msg("failed to set the layout of the handler");
+    }
+    else {
+        t_nRtn = 0;
+    }
+    sem_post(g_pStorageSem);
+
+    return t_nRtn;
+}
+
 int lgh_write(t_handlerref p_refIndex, const t_loggermsg *p_pMsg) {
     if (_lgh_check_init()) {
         return 1;
@@ -242,41 +715,109 @@ int lgh_write(t_handlerref p_refIndex, const t_loggermsg *p_pMsg) {
     // TODO if each handler gets its own read/write lock, this won't be needed
     sem_wait(g_pStorageSem); // get the storage lock
 
-    g_pHandlers[p_refIndex]->write(p_pMsg);
+    if (g_pWorkers[p_refIndex] != NULL) {
+        if (g_pWorkers[p_refIndex]->m_nBufRef >= 0)
+            _lgh_worker_write(g_pWorkers[p_refIndex], &p_pMsg, 1);
+    }
+    else {
+        g_pHandlers[p_refIndex]->write(g_pHandlers[p_refIndex]->m_pContext, p_pMsg);
+    }
 
     sem_post(g_pStorageSem);
 
     return 0;
 }
 
-int lgh_write_to_all(const t_loggermsg *p_pMsg) {
+int lgh_write_batch_to_all(const t_loggermsg **p_pMsgs, int p_nCount) {
     if (_lgh_check_init()) {
         return 1;
     }
 
-    int t_nHandlersWritten = 0;
+    int t_nFailed = 0;
 
     // TODO if each handler gets its own read/write lock, this won't be needed
     sem_wait(g_pStorageSem); // get the storage lock
 
+    /*
+     * find the handlers every message goes to, and the ones at least one goes
+     * to; a message whose handlers were all removed after it was logged is
+     * counted instead of written
+     */
+    unsigned int t_nLive = atomic_load(&g_nHandlerMask);
+    unsigned int t_nToAll = t_nLive;
+    unsigned int t_nToAny = 0;
+    for (int t_nMsg = 0; t_nMsg < p_nCount; t_nMsg++) {
+        unsigned int t_nHandlers = p_pMsgs[t_nMsg]->m_nHandlers & t_nLive;
+        if (t_nHandlers == 0)
+            lgh_add_unrouted(1);
+        t_nToAll &= t_nHandlers;
+        t_nToAny |= t_nHandlers;
+    }
+
     for (int t_nCount = 0; t_nCount < CLOGGER_MAX_NUM_HANDLERS; t_nCount++) {
-        if (g_pHandlers[t_nCount] != NULL) {
-            if (g_pHandlers[t_nCount]->isOpen()) {
-                if (g_pHandlers[t_nCount]->write(p_pMsg)) {
-                    // failed to write to a handler
-                    // TODO could we identify the handler that failed?
-                    lgu_warn_msg_int("failed to write to open handler at reference %d", t_nCount);
-                }
-                else {
-                    t_nHandlersWritten++;
-                }
+        unsigned int t_nBit = CLOGGER_HANDLER(t_nCount);
+        if (!(t_nToAny & t_nBit))
+            continue;
+        else if (t_nToAll & t_nBit) {
+            if (_lgh_deliver(t_nCount, p_pMsgs, p_nCount))
+                t_nFailed++;
+            continue;
+        }
+
+        // pick out the messages for this handler
+        const t_loggermsg* t_pSelected[LGH_ROUTE_BATCH_SIZE];
+        int t_nSelected = 0;
+        for (int t_nMsg = 0; t_nMsg < p_nCount; t_nMsg++) {
+            if (p_pMsgs[t_nMsg]->m_nHandlers & t_nBit)
+                t_pSelected[t_nSelected++] = p_pMsgs[t_nMsg];
+            if ((t_nSelected == LGH_ROUTE_BATCH_SIZE) || ((t_nSelected > 0) && (t_nMsg == p_nCount - 1))) {
+                if (_lgh_deliver(t_nCount, t_pSelected, t_nSelected))
+                    t_nFailed++;
+                t_nSelected = 0;
             }
         }
     }
 
     sem_post(g_pStorageSem);
 
-    if (t_nHandlersWritten) return 0;
-    else return 1;
+    return (t_nFailed > 0 ? 1 : 0);
 }
 
+/*
+ * Asks every handler that holds on to messages to write the ones that are due
+ * (or all of them when p_bForce is set).
+ *
+ * Returns 1 if any handler still has messages waiting, 0 if none do, or -1
+ * on error.
+ */
+int lgh_flush_all(bool p_bForce) {
+    if (_lgh_check_init()) {
+        return -1;
+    }
+
+    int t_nRtn = 0;
+
+    // TODO if each handler gets its own read/write lock, this won't be needed
+    sem_wait(g_pStorageSem); // get the storage lock
+
+    for (int t_nCount = 0; t_nCount < CLOGGER_MAX_NUM_HANDLERS; t_nCount++) {
+        log_handler* t_pHandler = g_pHandlers[t_nCount];
+        if ((t_pHandler == NULL) || (g_pWorkers[t_nCount] != NULL))
+            continue;   // handlers with their own thread flush themselves
+        else if ((t_pHandler->flush == NULL) || !t_pHandler->isOpen(t_pHandler->m_pContext))
+            continue;
+
+        int t_nFlushRtn = t_pHandler->flush(t_pHandler->m_pContext, p_bForce);
+        if (t_nFlushRtn < 0) {
+            lgu_warn_msg_int("failed to flush open handler at reference %d", t_nCount);
+            t_nRtn = -1;
+        }
+        else if ((t_nFlushRtn > 0) && (t_nRtn == 0)) {
+            t_nRtn = 1;
+        }
+    }
+
+    sem_post(g_pStorageSem);
+
+    return t_nRtn;
+}
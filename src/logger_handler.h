@@ -8,13 +8,43 @@ extern "C" {
 
 #include "logger_msg.h"
 
+/*
+ * write_batch is optional. When it's set, it's given every message the logger
+ * thread takes off the buffer at once (in the order they were logged) so the
+ * handler can write them with fewer calls; otherwise write is called for each
+ * message.
+ *
+ * flush is optional, for handlers that hold on to messages before writing
+ * them. The logger thread calls it after each batch and while it's idle with
+ * false, meaning "write what's due", and with true before it exits. It returns
+ * 1 if messages are still waiting, 0 if none are, or -1 on error.
+ *
+ * set_format is optional, for handlers that can write messages in more than
+ * one way; it's given one of the CLOGGER_FORMAT_* values and returns 0 if the
+ * handler supports it. It can be called while another thread is writing to
+ * the handler.
+ *
+ * set_layout is optional, for handlers that write text lines; it's given a
+ * pattern for lgf_compile_layout() and returns 0 if the pattern is valid. Like
+ * set_format, it can be called while another thread is writing to the handler.
+ *
+ * m_pContext holds the data of each instance of a handler and is passed to
+ * every callback. freeContext is called when the handler is removed; if the
+ * handler is still open at that point, it's closed first.
+ */
 typedef struct {
-    int (*const write)(const t_loggermsg*);
-    int (*const close)();
-    int (*const open)();
-    int (*const isOpen)();
+    int (*const write)(void*, const t_loggermsg*);
+    int (*const close)(void*);
+    int (*const open)(void*);
+    int (*const isOpen)(void*);
     bool m_bAllowEmptyLine;
     bool m_bAddFormat;
+    int (*const write_batch)(void*, const t_loggermsg**, int);
+    int (*const flush)(void*, bool);
+    int (*const set_format)(void*, int);
+    int (*const set_layout)(void*, const char*);
+    void (*const freeContext)(void*);
+    void* m_pContext;
 } log_handler;
 
 typedef uint8_t t_handlerref;
@@ -23,12 +53,21 @@ int lgh_init();
 int lgh_free();
 
 int lgh_add_handler(const log_handler* p_pHandler);
+void lgh_set_threaded(bool p_bThreaded);
+unsigned long lgh_get_dropped();
+void lgh_add_dropped(unsigned long p_nCount);
 int lgh_get_num_handlers();
+unsigned int lgh_get_handler_mask();
+unsigned long lgh_get_unrouted();
+void lgh_add_unrouted(unsigned long p_nCount);
 int lgh_open_handlers();
 int lgh_remove_handler(t_handlerref p_refIndex);
+int lgh_set_format(t_handlerref p_refIndex, int p_nFormat);
+int lgh_set_layout(t_handlerref p_refIndex, const char* p_sPattern);
 int lgh_remove_all_handlers();
 int lgh_write(t_handlerref p_nHandlerRef, const t_loggermsg *p_pMsg);
-int lgh_write_to_all(const t_loggermsg *p_pMsg);
+int lgh_write_batch_to_all(const t_loggermsg **p_pMsgs, int p_nCount);
+int lgh_flush_all(bool p_bForce);
 
 #ifdef __cplusplus
 }
@@ -1,40 +1,190 @@
-
 #include "logger_id.h"
 #include "logger_util.h" // lgu_warn_msg()
 
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h> // strlen()
 
-#define LOGGER_ID_NUM_READERS   3
+#define LOGGER_ID_NUM_BUCKETS   64  // starting size of the name index; doubles as IDs are added
+
+/*
+ * An ID's text never changes while it's in use, so the logger thread can read
+ * it without a lock. The text is followed by spaces up to the largest ID
+ * length, so every ID can be written at the width of the longest one.
+ *
+ * m_nRefs counts the messages on a buffer that use the ID. A removed ID's slot
+ * isn't given to a new ID until all of them have been written, so a message
+ * always shows the ID it was logged with. The default ID is never removed, so
+ * its messages aren't counted.
+ *
+ * m_nLevel and m_nHandlers are read by every thread that logs with the ID, so
+ * they can be changed at any time.
+ *
+ * The rest is only used while holding the write semaphore.
+ */
+typedef struct {
+    atomic_uint m_nRefs;
+    atomic_bool m_bActive;
+    atomic_int  m_nLevel;       // most verbose level logged; LOGGER_ID_LEVEL_GLOBAL to use the logger's
+    atomic_uint m_nHandlers;    // bit n is set to write to handler n
+    size_t      m_nLen;
+    int         m_nHashNext;    // next ID in the same bucket of the name index
+    int         m_nFreeNext;    // next removed ID waiting to be reused
+    char        m_sId[CLOGGER_ID_MAX_LEN];
+} lgi_entry;
+
+/*
+ * Entries are allocated LOGGER_ID_CHUNK_SIZE at a time and never move, so an
+ * ID is found with two array lookups and without a lock. A chunk is stored
+ * before g_nSlots is raised to include it.
+ */
+static _Atomic(lgi_entry*) g_pChunks[LOGGER_ID_MAX_CHUNKS];
+static atomic_int g_nSlots = { 0 };     // number of IDs ever handed out
 
 // global variables
-static sem_t *g_pReadSem = { NULL };    // semaphore that allows reading values
 static sem_t *g_pWriteSem = { NULL };   // semaphore that controls making modifications
-static char** g_pIdValPtrs = { NULL };
 static int volatile g_bRunning = { 0 };
-static size_t g_nLongestLen = { 0 };
+static atomic_size_t g_nLongestLen = { 0 };
+static int g_nLenCounts[CLOGGER_ID_MAX_LEN];    // number of active IDs of each length
+static int* g_pBuckets = { NULL };      // first ID in each bucket of the name index
+static size_t g_nNumBuckets = { 0 };
+static int g_nNumActive = { 0 };
+static int g_nFreeHead = { -1 };        // removed IDs, most recent first
 
 // private function declarations
-static int _lgi_update_existing_vals(size_t new_len);
+static lgi_entry* _lgi_entry(logger_id id_ref);
+static size_t _lgi_hash(const char* p_sId, size_t p_nLen);
+static int _lgi_grow_index();
+static void _lgi_index_remove(logger_id id_ref);
+static logger_id _lgi_take_slot();
 
 // private function definitions
-int _lgi_update_existing_vals(size_t new_len) {
-    /* this function expects the lock to already be required */
-    for (int count = 0; count < LOGGER_ID_MAX_IDS; count++) {
-        if (g_pIdValPtrs[count] != NULL) {
-            size_t len = strlen(g_pIdValPtrs[count]);
-            int new_final_index = (int) ((len / sizeof(char)) + ((new_len - len) / sizeof(char)));
-            int index;
-            for (index = len; index < new_final_index; index++) {
-                g_pIdValPtrs[count][index] = ' ';
-            }
-            g_pIdValPtrs[count][index] = '\0';
-        }
+
+/*
+ * Returns the entry for an ID that has been handed out, or NULL.
+ */
+lgi_entry* _lgi_entry(logger_id id_ref) {
+    if ((id_ref < 0) || (id_ref >= atomic_load_explicit(&g_nSlots, memory_order_acquire)))
+        return NULL;
+    lgi_entry* t_pChunk = atomic_load_explicit(&g_pChunks[id_ref / LOGGER_ID_CHUNK_SIZE], memory_order_relaxed);
+    return &t_pChunk[id_ref % LOGGER_ID_CHUNK_SIZE];
+}
+
+// FNV-1a
+size_t _lgi_hash(const char* p_sId, size_t p_nLen) {
+    uint64_t t_nHash = 14695981039346656037ULL;
+    for (size_t count = 0; count < p_nLen; count++) {
+        t_nHash ^= (unsigned char) p_sId[count];
+        t_nHash *= 1099511628211ULL;
+    }
+    return (size_t) t_nHash;
+}
+
+/*
+ * Doubles the number of buckets in the name index. Expects the write
+ * semaphore to be held.
+ */
+int _lgi_grow_index() {
+
+    size_t t_nNumBuckets = (g_nNumBuckets == 0 ? LOGGER_ID_NUM_BUCKETS : g_nNumBuckets * 2);
+    int* t_pBuckets = (int*) malloc(sizeof(int) * t_nNumBuckets);
+    if (t_pBuckets == NULL) {
+        lgu_warn_msg("Failed to allocate space for the logger ID index.");
+        return 1;
+    }
+    for (size_t count = 0; count < t_nNumBuckets; count++)
+        t_pBuckets[count] = -1;
+
+    int t_nSlots = atomic_load_explicit(&g_nSlots, memory_order_relaxed);
+    for (int count = 0; count < t_nSlots; count++) {
+        lgi_entry* t_pEntry = _lgi_entry(count);
+        if (!atomic_load_explicit(&t_pEntry->m_bActive, memory_order_relaxed))
+            continue;
+        size_t t_nBucket = _lgi_hash(t_pEntry->m_sId, t_pEntry->m_nLen) & (t_nNumBuckets - 1);
+        t_pEntry->m_nHashNext = t_pBuckets[t_nBucket];
+        t_pBuckets[t_nBucket] = count;
     }
+
+    free(g_pBuckets);
+    g_pBuckets = t_pBuckets;
+    g_nNumBuckets = t_nNumBuckets;
+
     return 0;
 }
 
+/*
+ * Takes an active ID out of the name index. Expects the write semaphore to
+ * be held.
+ */
+void _lgi_index_remove(logger_id id_ref) {
+
+    lgi_entry* t_pEntry = _lgi_entry(id_ref);
+    int* t_pLink = &g_pBuckets[_lgi_hash(t_pEntry->m_sId, t_pEntry->m_nLen) & (g_nNumBuckets - 1)];
+    while (*t_pLink != -1) {
+        if (*t_pLink == id_ref) {
+            *t_pLink = t_pEntry->m_nHashNext;
+            break;
+        }
+        t_pLink = &_lgi_entry(*t_pLink)->m_nHashNext;
+    }
+    t_pEntry->m_nHashNext = -1;
+}
+
+/*
+ * Returns a slot for a new ID: a removed one whose messages have all been
+ * written, or else a new one, allocating another chunk when needed. Expects
+ * the write semaphore to be held.
+ *
+ * Returns -1 when there's no room left.
+ */
+logger_id _lgi_take_slot() {
+
+    int* t_pLink = &g_nFreeHead;
+    while (*t_pLink != -1) {
+        logger_id t_nId = *t_pLink;
+        lgi_entry* t_pEntry = _lgi_entry(t_nId);
+        if (atomic_load(&t_pEntry->m_nRefs) == 0) {
+            *t_pLink = t_pEntry->m_nFreeNext;
+            t_pEntry->m_nFreeNext = -1;
+            return t_nId;
+        }
+        t_pLink = &t_pEntry->m_nFreeNext;
+    }
+
+    int t_nSlots = atomic_load_explicit(&g_nSlots, memory_order_relaxed);
+    if (t_nSlots >= LOGGER_ID_MAX_IDS) {
+        lgu_warn_msg_int("Can't have more than %d logger IDs.", LOGGER_ID_MAX_IDS);
+        return -1;
+    }
+
+    int t_nChunk = t_nSlots / LOGGER_ID_CHUNK_SIZE;
+    if (atomic_load_explicit(&g_pChunks[t_nChunk], memory_order_relaxed) == NULL) {
+        lgi_entry* t_pChunk = (lgi_entry*) malloc(sizeof(lgi_entry) * LOGGER_ID_CHUNK_SIZE);
+        if (t_pChunk == NULL) {
+            lgu_warn_msg("Failed to allocate space for logger IDs.");
+            return -1;
+        }
+        for (int count = 0; count < LOGGER_ID_CHUNK_SIZE; count++) {
+            atomic_init(&t_pChunk[count].m_nRefs, 0);
+            atomic_init(&t_pChunk[count].m_bActive, false);
+            atomic_init(&t_pChunk[count].m_nLevel, LOGGER_ID_LEVEL_GLOBAL);
+            atomic_init(&t_pChunk[count].m_nHandlers, CLOGGER_ALL_HANDLERS);
+            t_pChunk[count].m_nLen = 0;
+            t_pChunk[count].m_nHashNext = -1;
+            t_pChunk[count].m_nFreeNext = -1;
+            t_pChunk[count].m_sId[0] = '\0';
+        }
+        atomic_store_explicit(&g_pChunks[t_nChunk], t_pChunk, memory_order_relaxed);
+    }
+
+    // publishes the chunk along with the new count
+    atomic_store_explicit(&g_nSlots, t_nSlots + 1, memory_order_release);
+
+    return t_nSlots;
+}
+
 // public functions
 int lgi_init() {
 
@@ -43,28 +193,30 @@ int lgi_init() {
         return 1;
     }
 
-    if (g_pIdValPtrs != NULL)
+    if (g_pWriteSem != NULL)
         return 1;
 
-    g_pIdValPtrs = (char**) malloc(sizeof(char*) * LOGGER_ID_MAX_IDS);
-    if (g_pIdValPtrs == NULL) {
-        lgu_warn_msg("Failed to allocate space for logger IDs.");
-        return 1;
-    }
-
-    for (int count = 0; count < LOGGER_ID_MAX_IDS; count++) {
-        g_pIdValPtrs[count] = NULL;
-    }
-
-    g_pReadSem = (sem_t*) malloc(sizeof(sem_t));
     g_pWriteSem = (sem_t*) malloc(sizeof(sem_t));
-    if ((g_pReadSem == NULL) || (g_pWriteSem == NULL)) {
+    if (g_pWriteSem == NULL) {
         lgu_warn_msg("Failed to allocate space for logger id locks.");
         return 1;
     }
-    sem_init(g_pReadSem, 0, LOGGER_ID_NUM_READERS);
     sem_init(g_pWriteSem, 0, 1);
 
+    for (int count = 0; count < LOGGER_ID_MAX_CHUNKS; count++)
+        atomic_init(&g_pChunks[count], NULL);
+    atomic_store(&g_nSlots, 0);
+    memset(g_nLenCounts, 0, sizeof(g_nLenCounts));
+    g_nNumActive = 0;
+    g_nFreeHead = -1;
+
+    if (_lgi_grow_index()) {
+        sem_destroy(g_pWriteSem);
+        free(g_pWriteSem);
+        g_pWriteSem = NULL;
+        return 1;
+    }
+
     g_bRunning = 1;
 
     return 0;
@@ -80,38 +232,29 @@ int lgi_free() {
 
     g_bRunning = 0;
 
-    if (g_pIdValPtrs == NULL) {
+    if (g_pWriteSem == NULL) {
         // TODO should we indicate an error?
         return 0;
     }
 
     // get the mutex to modify data
     sem_wait(g_pWriteSem);
-    // get all of the reader locks
-    for (int count = 0; count < LOGGER_ID_NUM_READERS; count++) {
-        // TODO change to sem_timedwait()
-        sem_wait(g_pReadSem);
-    }
 
-    for (int count = 0; count < LOGGER_ID_MAX_IDS; count++) {
-        if (g_pIdValPtrs[count] != NULL) {
-            free(g_pIdValPtrs[count]);
-            g_pIdValPtrs[count] = NULL;
-        }
+    atomic_store(&g_nSlots, 0);
+    for (int count = 0; count < LOGGER_ID_MAX_CHUNKS; count++) {
+        free(atomic_load(&g_pChunks[count]));
+        atomic_store(&g_pChunks[count], NULL);
     }
-    free(g_pIdValPtrs);
-    g_pIdValPtrs = NULL;
 
-    sem_destroy(g_pReadSem);
-    free(g_pReadSem);
+    free(g_pBuckets);
+    g_pBuckets = NULL;
+    g_nNumBuckets = 0;
 
     sem_destroy(g_pWriteSem);
     free(g_pWriteSem);
-
-    g_pReadSem = NULL;
     g_pWriteSem = NULL;
 
-    g_nLongestLen = 0;
+    atomic_store(&g_nLongestLen, 0);
 
     return 0;
 }
@@ -123,42 +266,72 @@ logger_id lgi_add_id(char* p_sId) {
         return -1;
     }
 
-    int rtn_val = -1;
+    size_t t_nLen = strlen(p_sId);
+    if (t_nLen >= CLOGGER_ID_MAX_LEN) {
+        lgu_warn_msg("The logger ID given was too large to add.");
+        return -1;
+    }
 
     // get the mutex to modify data
     sem_wait(g_pWriteSem);
-    // get all of the reader locks
-    for (int count = 0; count < LOGGER_ID_NUM_READERS; count++) {
-        // TODO change to sem_timedwait()
-        sem_wait(g_pReadSem);
-    }
-
-    // have all the locks; modify the data
-    for (int count = 0; count < LOGGER_ID_MAX_IDS; count++) {
-        if (g_pIdValPtrs[count] == NULL) {
-            g_pIdValPtrs[count] = (char*) malloc(sizeof(char) * CLOGGER_ID_MAX_LEN);
-            if (g_pIdValPtrs[count] == NULL) {
-                lgu_warn_msg("Failed to create space for the new logger ID.");
-                break;
-            }
-            size_t snrtn = snprintf(g_pIdValPtrs[count], CLOGGER_ID_MAX_LEN, "%s", p_sId);
-            if (snrtn >= CLOGGER_ID_MAX_LEN) {
-                lgu_warn_msg("The logger ID given was too large to add.");
-                break;
-            }
-
-            if (snrtn > g_nLongestLen) {
-                g_nLongestLen = snrtn;
-                _lgi_update_existing_vals(g_nLongestLen);
-            }
-            rtn_val = count;
-            break;
-        }
+
+    // keep the chains short; a failure only makes lookups by name slower
+    if ((size_t) g_nNumActive >= g_nNumBuckets)
+        _lgi_grow_index();
+
+    logger_id rtn_val = _lgi_take_slot();
+    if (rtn_val >= 0) {
+        lgi_entry* t_pEntry = _lgi_entry(rtn_val);
+        memcpy(t_pEntry->m_sId, p_sId, t_nLen);
+        memset(t_pEntry->m_sId + t_nLen, ' ', CLOGGER_ID_MAX_LEN - 1 - t_nLen);
+        t_pEntry->m_sId[CLOGGER_ID_MAX_LEN - 1] = '\0';
+        t_pEntry->m_nLen = t_nLen;
+        atomic_store_explicit(&t_pEntry->m_nLevel, LOGGER_ID_LEVEL_GLOBAL, memory_order_relaxed);
+        atomic_store_explicit(&t_pEntry->m_nHandlers, CLOGGER_ALL_HANDLERS, memory_order_relaxed);
+
+        size_t t_nBucket = _lgi_hash(p_sId, t_nLen) & (g_nNumBuckets - 1);
+        t_pEntry->m_nHashNext = g_pBuckets[t_nBucket];
+        g_pBuckets[t_nBucket] = rtn_val;
+
+        g_nNumActive++;
+        g_nLenCounts[t_nLen]++;
+        if (t_nLen > atomic_load(&g_nLongestLen))
+            atomic_store(&g_nLongestLen, t_nLen);
+
+        // publish the text before the ID can be used
+        atomic_store_explicit(&t_pEntry->m_bActive, true, memory_order_release);
     }
 
-    for (int sem_count = 0; sem_count < LOGGER_ID_NUM_READERS; sem_count++) {
-        sem_post(g_pReadSem);
+    sem_post(g_pWriteSem);
+
+    return rtn_val;
+}
+
+/*
+ * Returns an ID that was added with the given text, or -1 if there
+ * isn't one.
+ */
+logger_id lgi_find_id(const char* p_sId) {
+
+    if (!g_bRunning) {
+        lgu_warn_msg("Logger IDs not initialized.");
+        return -1;
     }
+
+    size_t t_nLen = strlen(p_sId);
+    if (t_nLen >= CLOGGER_ID_MAX_LEN)
+        return -1;
+
+    sem_wait(g_pWriteSem);
+
+    logger_id rtn_val = g_pBuckets[_lgi_hash(p_sId, t_nLen) & (g_nNumBuckets - 1)];
+    while (rtn_val != -1) {
+        lgi_entry* t_pEntry = _lgi_entry(rtn_val);
+        if ((t_pEntry->m_nLen == t_nLen) && (memcmp(t_pEntry->m_sId, p_sId, t_nLen) == 0))
+            break;
+        rtn_val = t_pEntry->m_nHashNext;
+    }
+
     sem_post(g_pWriteSem);
 
     return rtn_val;
@@ -171,34 +344,114 @@ int lgi_get_id(logger_id id_ref, char* dest) {
         return 1;
     }
 
-    int rtn_val = 0;
-
-    // TODO sem_trywait() or sem_timedwait()
-    sem_wait(g_pReadSem);
-    if (g_pIdValPtrs[id_ref] == NULL) {
+    lgi_entry* t_pEntry = _lgi_entry(id_ref);
+    if ((t_pEntry == NULL) || !atomic_load_explicit(&t_pEntry->m_bActive, memory_order_acquire)) {
         lgu_warn_msg_int("No value exists for ID at location %d", id_ref);
-        rtn_val = 1;
+        return 1;
     }
     else if (dest == NULL) {
         lgu_warn_msg("Can't copy ID to NULL location.");
-        rtn_val = 1;
+        return 1;
     }
 
-    if (rtn_val == 0) {
-        int copy_rtn = snprintf(dest, CLOGGER_ID_MAX_LEN, "%s", g_pIdValPtrs[id_ref]);
-        if ((copy_rtn >= CLOGGER_ID_MAX_LEN) || (copy_rtn < 0)) {
-            lgu_warn_msg("Failed to copy the ID to the destination.");
-            rtn_val = 1;
-        }
+    memcpy(dest, t_pEntry->m_sId, t_pEntry->m_nLen);
+    dest[t_pEntry->m_nLen] = '\0';
+
+    return 0;
+}
+
+/*
+ * Gets the level and handlers set for an ID. The level is
+ * LOGGER_ID_LEVEL_GLOBAL unless one was set.
+ *
+ * Returns non-zero if the ID doesn't exist.
+ */
+int lgi_get_route(logger_id id_ref, int* p_nLevel, unsigned int* p_nHandlers) {
+    lgi_entry* t_pEntry = _lgi_entry(id_ref);
+    if (t_pEntry == NULL)
+        return 1;
+    *p_nLevel = atomic_load_explicit(&t_pEntry->m_nLevel, memory_order_relaxed);
+    *p_nHandlers = atomic_load_explicit(&t_pEntry->m_nHandlers, memory_order_relaxed);
+    return 0;
+}
+
+int lgi_set_level(logger_id id_ref, int p_nLevel) {
+    lgi_entry* t_pEntry = (g_bRunning ? _lgi_entry(id_ref) : NULL);
+    if ((t_pEntry == NULL) || !atomic_load(&t_pEntry->m_bActive)) {
+        lgu_warn_msg_int("No value exists for ID at location %d", id_ref);
+        return 1;
     }
+    atomic_store_explicit(&t_pEntry->m_nLevel, p_nLevel, memory_order_relaxed);
+    return 0;
+}
 
-    sem_post(g_pReadSem);
-    return rtn_val;
+int lgi_set_handlers(logger_id id_ref, unsigned int p_nHandlers) {
+    lgi_entry* t_pEntry = (g_bRunning ? _lgi_entry(id_ref) : NULL);
+    if ((t_pEntry == NULL) || !atomic_load(&t_pEntry->m_bActive)) {
+        lgu_warn_msg_int("No value exists for ID at location %d", id_ref);
+        return 1;
+    }
+    atomic_store_explicit(&t_pEntry->m_nHandlers, p_nHandlers, memory_order_relaxed);
+    return 0;
+}
+
+/*
+ * Called before a message using the ID is added to a buffer. Keeps the ID
+ * from being replaced until lgi_release_id() is called for the message.
+ *
+ * Returns non-zero if the ID doesn't exist.
+ */
+int lgi_hold_id(logger_id id_ref) {
+
+    lgi_entry* t_pEntry = (g_bRunning ? _lgi_entry(id_ref) : NULL);
+    if (t_pEntry == NULL) {
+        lgu_warn_msg_int("No value exists for ID at location %d", id_ref);
+        return 1;
+    }
+    else if (id_ref == CLOGGER_DEFAULT_ID) {
+        return 0;
+    }
 
+    // count the message before checking the ID, so a new ID can't take the slot between the two
+    atomic_fetch_add_explicit(&t_pEntry->m_nRefs, 1, memory_order_seq_cst);
+    if (!atomic_load_explicit(&t_pEntry->m_bActive, memory_order_seq_cst)) {
+        atomic_fetch_sub_explicit(&t_pEntry->m_nRefs, 1, memory_order_release);
+        lgu_warn_msg_int("No value exists for ID at location %d", id_ref);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Called once a message held with lgi_hold_id() has been written or dropped.
+ */
+void lgi_release_id(logger_id id_ref) {
+    if (id_ref == CLOGGER_DEFAULT_ID)
+        return;
+    lgi_entry* t_pEntry = _lgi_entry(id_ref);
+    if (t_pEntry != NULL)
+        atomic_fetch_sub_explicit(&t_pEntry->m_nRefs, 1, memory_order_release);
+}
+
+/*
+ * Returns the text of an ID without copying it, and puts in p_nLen the
+ * number of characters to write so it lines up with the longest ID. Only
+ * valid while a message using the ID is held.
+ */
+const char* lgi_peek_id(logger_id id_ref, int* p_nLen) {
+    lgi_entry* t_pEntry = _lgi_entry(id_ref);
+    if (t_pEntry == NULL) {
+        *p_nLen = 0;
+        return "";
+    }
+    size_t t_nLen = atomic_load_explicit(&g_nLongestLen, memory_order_relaxed);
+    *p_nLen = (int) (t_pEntry->m_nLen > t_nLen ? t_pEntry->m_nLen : t_nLen);
+    return t_pEntry->m_sId;
 }
 
 int lgi_get_longest_len() {
-    return g_nLongestLen;
+    return (int) atomic_load_explicit(&g_nLongestLen, memory_order_relaxed);
 }
 
 int lgi_remove_id(logger_id id_ref) {
@@ -215,30 +468,34 @@ int lgi_remove_id(logger_id id_ref) {
 
     // get the mutex to modify data
     sem_wait(g_pWriteSem);
-    // get all of the reader locks
-    for (int count = 0; count < LOGGER_ID_NUM_READERS; count++) {
-        // TODO change to sem_timedwait()
-        sem_wait(g_pReadSem);
-    }
 
-    // have all the locks; modify the data
-    if (g_pIdValPtrs[id_ref] == NULL) {
+    /*
+     * The slot keeps its text until every message using it has been written;
+     * lgi_add_id() won't reuse it before then.
+     */
+    lgi_entry* t_pEntry = _lgi_entry(id_ref);
+    if ((t_pEntry == NULL) || !atomic_load(&t_pEntry->m_bActive)) {
         lgu_warn_msg_int("No ID to remove at %d", id_ref);
         rtn_val = 1;
     }
     else {
-        free(g_pIdValPtrs[id_ref]);
-        g_pIdValPtrs[id_ref] = NULL;
-        rtn_val = 0;
-    }
+        atomic_store(&t_pEntry->m_bActive, false);
+        _lgi_index_remove(id_ref);
+        t_pEntry->m_nFreeNext = g_nFreeHead;
+        g_nFreeHead = id_ref;
+        g_nNumActive--;
+
+        // shrink the width IDs are written at if this was the last of the longest ones
+        g_nLenCounts[t_pEntry->m_nLen]--;
+        size_t t_nLongest = atomic_load(&g_nLongestLen);
+        while ((t_nLongest > 0) && (g_nLenCounts[t_nLongest] == 0))
+            t_nLongest--;
+        atomic_store(&g_nLongestLen, t_nLongest);
 
-    for (int sem_count = 0; sem_count < LOGGER_ID_NUM_READERS; sem_count++) {
-        sem_post(g_pReadSem);
+        rtn_val = 0;
     }
 
-    // TODO determine length of item removed and update g_nLongestLen ?
     sem_post(g_pWriteSem);
 
     return rtn_val;
 }
-
@@ -8,7 +8,13 @@ extern "C" {
 
 #include "clogger.h"
 
-#define LOGGER_ID_MAX_IDS   20
+// IDs are stored in chunks that are allocated as they're needed
+#define LOGGER_ID_CHUNK_SIZE    256
+#define LOGGER_ID_MAX_CHUNKS    256
+#define LOGGER_ID_MAX_IDS       (LOGGER_ID_CHUNK_SIZE * LOGGER_ID_MAX_CHUNKS)
+
+// an ID's level when it follows the logger's
+#define LOGGER_ID_LEVEL_GLOBAL  -1
 
 int lgi_init();
 int lgi_free();
@@ -16,6 +22,15 @@ int lgi_free();
 int lgi_add_id(char* p_sID);
 int lgi_get_id(logger_id id_ref, char* dest);
 int lgi_remove_id(logger_id id_ref);
+logger_id lgi_find_id(const char* p_sId);
+
+int lgi_hold_id(logger_id id_ref);
+void lgi_release_id(logger_id id_ref);
+const char* lgi_peek_id(logger_id id_ref, int* p_nLen);
+
+int lgi_get_route(logger_id id_ref, int* p_nLevel, unsigned int* p_nHandlers);
+int lgi_set_level(logger_id id_ref, int p_nLevel);
+int lgi_set_handlers(logger_id id_ref, unsigned int p_nHandlers);
 
 logger_id lgi_add_id(char* p_sId);
 
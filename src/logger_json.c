@@ -0,0 +1,279 @@
+
+#include "logger_json.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// x86-64 builds can always use SSE2; AVX2 is checked for when it's first needed
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__AVX2__)
+#define LGJ_CHECK_AVX2
+#endif
+
+// space for the names and values of a line's fields besides the escaped strings
+#define LGJ_LINE_FIELDS_SIZE 160
+
+static const char g_sHex[] = "0123456789abcdef";
+
+/*
+ * The character written after a backslash for each character that has to be
+ * escaped, 'u' for the ones written as \u00XX, or 0 for the ones copied as
+ * they are.
+ */
+static const char g_cEscapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0
+    // the rest are 0
+};
+
+// PRIVATE FUNCTION DECLARATIONS
+static inline char* _lgj_escape_char(char* p_pDest, unsigned char p_cChar);
+static char* _lgj_escape_scalar(char* p_pDest, const char* p_sSrc, size_t p_nLen);
+static inline char* _lgj_append(char* p_pDest, const char* p_sSrc, size_t p_nLen);
+static char* _lgj_write_uint(char* p_pDest, uint64_t p_nValue);
+static size_t _lgj_trimmed_id_len(const t_loggermsg* p_pMsg);
+#if defined(__SSE2__)
+static char* _lgj_escape_sse2(char* p_pDest, const char* p_sSrc, size_t p_nLen);
+#endif
+#if defined(__AVX2__) || defined(LGJ_CHECK_AVX2)
+static char* _lgj_escape_avx2(char* p_pDest, const char* p_sSrc, size_t p_nLen);
+#endif
+// END PRIVATE FUNCTION DECLARATIONS
+
+// PRIVATE FUNCTION DEFINITIONS
+
+// writes the escape sequence for a character that needs one
+char* _lgj_escape_char(char* p_pDest, unsigned char p_cChar) {
+    char t_cEscape = g_cEscapes[p_cChar];
+    *p_pDest++ = '\\';
+    *p_pDest++ = t_cEscape;
+    if (t_cEscape == 'u') {
+        *p_pDest++ = '0';
+        *p_pDest++ = '0';
+        *p_pDest++ = g_sHex[p_cChar >> 4];
+        *p_pDest++ = g_sHex[p_cChar & 0xf];
+    }
+    return p_pDest;
+}
+
+char* _lgj_escape_scalar(char* p_pDest, const char* p_sSrc, size_t p_nLen) {
+    for (size_t count = 0; count < p_nLen; count++) {
+        unsigned char t_cChar = (unsigned char) p_sSrc[count];
+        if (g_cEscapes[t_cChar] == 0)
+            *p_pDest++ = (char) t_cChar;
+        else
+            p_pDest = _lgj_escape_char(p_pDest, t_cChar);
+    }
+    return p_pDest;
+}
+
+char* _lgj_append(char* p_pDest, const char* p_sSrc, size_t p_nLen) {
+    memcpy(p_pDest, p_sSrc, p_nLen);
+    return p_pDest + p_nLen;
+}
+
+char* _lgj_write_uint(char* p_pDest, uint64_t p_nValue) {
+    char t_sDigits[20];
+    int t_nDigits = 0;
+    do {
+        t_sDigits[t_nDigits++] = (char) ('0' + (p_nValue % 10));
+        p_nValue /= 10;
+    } while (p_nValue > 0);
+
+    while (t_nDigits > 0)
+        *p_pDest++ = t_sDigits[--t_nDigits];
+    return p_pDest;
+}
+
+// IDs are padded to line up in text; the padding isn't part of the ID
+size_t _lgj_trimmed_id_len(const t_loggermsg* p_pMsg) {
+    size_t t_nIdLen = (size_t) p_pMsg->m_nIdLen;
+    while ((t_nIdLen > 0) && (p_pMsg->m_sId[t_nIdLen - 1] == ' '))
+        t_nIdLen--;
+    return t_nIdLen;
+}
+
+#if defined(__SSE2__)
+/*
+ * Checks 16 characters at a time for ones that need escaping. Each block is
+ * stored to p_pDest before it's checked; when something needs escaping only
+ * the characters before it are kept, and the next block starts after it.
+ * p_pDest always has room for the extra characters stored.
+ */
+char* _lgj_escape_sse2(char* p_pDest, const char* p_sSrc, size_t p_nLen) {
+
+    const __m128i t_vCtrl = _mm_set1_epi8(0x1f);
+    const __m128i t_vQuote = _mm_set1_epi8('"');
+    const __m128i t_vSlash = _mm_set1_epi8('\\');
+
+    size_t t_nPos = 0;
+    while ((p_nLen - t_nPos) >= 16) {
+        __m128i t_vChars = _mm_loadu_si128((const __m128i*) (p_sSrc + t_nPos));
+        _mm_storeu_si128((__m128i*) p_pDest, t_vChars);
+
+        // unsigned max() finds the control characters without a signed compare
+        __m128i t_vFound = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_max_epu8(t_vChars, t_vCtrl), t_vCtrl),
+            _mm_or_si128(_mm_cmpeq_epi8(t_vChars, t_vQuote), _mm_cmpeq_epi8(t_vChars, t_vSlash)));
+        unsigned int t_nMask = (unsigned int) _mm_movemask_epi8(t_vFound);
+
+        if (t_nMask == 0) {
+            p_pDest += 16;
+            t_nPos += 16;
+            continue;
+        }
+
+        unsigned int t_nSkip = (unsigned int) __builtin_ctz(t_nMask);
+        p_pDest += t_nSkip;
+        t_nPos += t_nSkip;
+        p_pDest = _lgj_escape_char(p_pDest, (unsigned char) p_sSrc[t_nPos++]);
+    }
+
+    return _lgj_escape_scalar(p_pDest, p_sSrc + t_nPos, p_nLen - t_nPos);
+}
+#endif
+
+#if defined(__AVX2__) || defined(LGJ_CHECK_AVX2)
+// the same as _lgj_escape_sse2() with 32 characters at a time
+__attribute__((target("avx2")))
+char* _lgj_escape_avx2(char* p_pDest, const char* p_sSrc, size_t p_nLen) {
+
+    const __m256i t_vCtrl = _mm256_set1_epi8(0x1f);
+    const __m256i t_vQuote = _mm256_set1_epi8('"');
+    const __m256i t_vSlash = _mm256_set1_epi8('\\');
+
+    size_t t_nPos = 0;
+    while ((p_nLen - t_nPos) >= 32) {
+        __m256i t_vChars = _mm256_loadu_si256((const __m256i*) (p_sSrc + t_nPos));
+        _mm256_storeu_si256((__m256i*) p_pDest, t_vChars);
+
+        __m256i t_vFound = _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_max_epu8(t_vChars, t_vCtrl), t_vCtrl),
+            _mm256_or_si256(_mm256_cmpeq_epi8(t_vChars, t_vQuote), _mm256_cmpeq_epi8(t_vChars, t_vSlash)));
+        unsigned int t_nMask = (unsigned int) _mm256_movemask_epi8(t_vFound);
+
+        if (t_nMask == 0) {
+            p_pDest += 32;
+            t_nPos += 32;
+            continue;
+        }
+
+        unsigned int t_nSkip = (unsigned int) __builtin_ctz(t_nMask);
+        p_pDest += t_nSkip;
+        t_nPos += t_nSkip;
+        p_pDest = _lgj_escape_char(p_pDest, (unsigned char) p_sSrc[t_nPos++]);
+    }
+
+    // the upper halves of the registers must be cleared before running SSE code
+    _mm256_zeroupper();
+    return _lgj_escape_sse2(p_pDest, p_sSrc + t_nPos, p_nLen - t_nPos);
+}
+#endif
+// END PRIVATE FUNCTION DEFINITIONS
+
+// PUBLIC FUNCTION DEFINITIONS
+char* lgj_escape(char* p_pDest, const char* p_sSrc, size_t p_nLen) {
+#if defined(__AVX2__)
+    return _lgj_escape_avx2(p_pDest, p_sSrc, p_nLen);
+#elif defined(LGJ_CHECK_AVX2)
+    // only worth checking for AVX2 when there's a full block for it
+    if ((p_nLen >= 32) && __builtin_cpu_supports("avx2"))
+        return _lgj_escape_avx2(p_pDest, p_sSrc, p_nLen);
+    return _lgj_escape_sse2(p_pDest, p_sSrc, p_nLen);
+#elif defined(__SSE2__)
+    return _lgj_escape_sse2(p_pDest, p_sSrc, p_nLen);
+#else
+    return _lgj_escape_scalar(p_pDest, p_sSrc, p_nLen);
+#endif
+}
+
+char* lgj_escape_using(int p_nImpl, char* p_pDest, const char* p_sSrc, size_t p_nLen) {
+    switch (p_nImpl) {
+        case LGJ_ESCAPE_SCALAR:
+            return _lgj_escape_scalar(p_pDest, p_sSrc, p_nLen);
+#if defined(__SSE2__)
+        case LGJ_ESCAPE_SSE2:
+            return _lgj_escape_sse2(p_pDest, p_sSrc, p_nLen);
+#endif
+#if defined(__AVX2__)
+        case LGJ_ESCAPE_AVX2:
+            return _lgj_escape_avx2(p_pDest, p_sSrc, p_nLen);
+#elif defined(LGJ_CHECK_AVX2)
+        case LGJ_ESCAPE_AVX2:
+            if (!__builtin_cpu_supports("avx2"))
+                return NULL;
+            return _lgj_escape_avx2(p_pDest, p_sSrc, p_nLen);
+#endif
+        default:
+            return NULL;
+    }
+}
+
+size_t lgj_line_max_len(const t_loggermsg* p_pMsg) {
+    size_t t_nStrLen = (size_t) p_pMsg->m_nMsgLen + _lgj_trimmed_id_len(p_pMsg);
+    if (p_pMsg->m_sFile != NULL)
+        t_nStrLen += strlen(p_pMsg->m_sFile);
+    if (p_pMsg->m_sFunc != NULL)
+        t_nStrLen += strlen(p_pMsg->m_sFunc);
+    return LGJ_LINE_FIELDS_SIZE + LGJ_ESCAPED_MAX_LEN(t_nStrLen);
+}
+
+/*
+ * Every field is copied or escaped straight into p_pDest, in one pass,
+ * without printf().
+ */
+char* lgj_format_line(char* p_pDest, const t_loggermsg* p_pMsg) {
+
+    static const char t_sTime[] = "{\"time\":";
+    static const char t_sLevel[] = ",\"level\":\"";
+    static const char t_sId[] = "\",\"id\":\"";
+    static const char t_sMsg[] = "\",\"msg\":\"";
+    static const char t_sThread[] = "\",\"thread\":";
+    static const char t_sFile[] = ",\"file\":\"";
+    static const char t_sLine[] = "\",\"line\":";
+    static const char t_sFunc[] = ",\"func\":\"";
+
+    // seconds with microseconds, the same as the Graylog handler sends
+    p_pDest = _lgj_append(p_pDest, t_sTime, sizeof(t_sTime) - 1);
+    p_pDest = _lgj_write_uint(p_pDest, p_pMsg->m_nTimestamp / 1000000000);
+    *p_pDest++ = '.';
+    uint64_t t_nMicros = (p_pMsg->m_nTimestamp % 1000000000) / 1000;
+    for (int t_nDivisor = 100000; t_nDivisor > 0; t_nDivisor /= 10)
+        *p_pDest++ = (char) ('0' + ((t_nMicros / t_nDivisor) % 10));
+
+    const char* t_sLevelName = lgl_lstrs[p_pMsg->m_nLogLevel];
+    p_pDest = _lgj_append(p_pDest, t_sLevel, sizeof(t_sLevel) - 1);
+    p_pDest = _lgj_append(p_pDest, t_sLevelName, strlen(t_sLevelName));
+
+    p_pDest = _lgj_append(p_pDest, t_sId, sizeof(t_sId) - 1);
+    p_pDest = lgj_escape(p_pDest, p_pMsg->m_sId, _lgj_trimmed_id_len(p_pMsg));
+
+    p_pDest = _lgj_append(p_pDest, t_sMsg, sizeof(t_sMsg) - 1);
+    p_pDest = lgj_escape(p_pDest, p_pMsg->m_sMsg, (size_t) p_pMsg->m_nMsgLen);
+
+    p_pDest = _lgj_append(p_pDest, t_sThread, sizeof(t_sThread) - 1);
+    p_pDest = _lgj_write_uint(p_pDest, (uint64_t) p_pMsg->m_nThreadId);
+
+    if (p_pMsg->m_sFile != NULL) {
+        p_pDest = _lgj_append(p_pDest, t_sFile, sizeof(t_sFile) - 1);
+        p_pDest = lgj_escape(p_pDest, p_pMsg->m_sFile, strlen(p_pMsg->m_sFile));
+        p_pDest = _lgj_append(p_pDest, t_sLine, sizeof(t_sLine) - 1);
+        p_pDest = _lgj_write_uint(p_pDest, (uint64_t) p_pMsg->m_nLine);
+    }
+    if (p_pMsg->m_sFunc != NULL) {
+        p_pDest = _lgj_append(p_pDest, t_sFunc, sizeof(t_sFunc) - 1);
+        p_pDest = lgj_escape(p_pDest, p_pMsg->m_sFunc, strlen(p_pMsg->m_sFunc));
+        *p_pDest++ = '"';
+    }
+
+    *p_pDest++ = '}';
+    *p_pDest++ = '\n';
+    return p_pDest;
+}
+// END PUBLIC FUNCTION DEFINITIONS
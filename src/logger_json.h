@@ -0,0 +1,56 @@
+
+#ifndef LOGGER_JSON_H_INCLUDED
+#define LOGGER_JSON_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "logger_msg.h"
+
+#include <stddef.h>
+
+// most characters lgj_escape() can write for p_nLen characters of input
+#define LGJ_ESCAPED_MAX_LEN(p_nLen) ((p_nLen) * 6)
+
+/*
+ * Copies p_nLen characters of p_sSrc to p_pDest as the inside of a JSON
+ * string, escaping quotes, backslashes and control characters. p_pDest needs
+ * room for LGJ_ESCAPED_MAX_LEN(p_nLen) characters; nothing is null-terminated.
+ *
+ * Returns the end of what was written.
+ */
+char* lgj_escape(char* p_pDest, const char* p_sSrc, size_t p_nLen);
+
+// the ways lgj_escape() can check for characters to escape
+#define LGJ_ESCAPE_SCALAR   0
+#define LGJ_ESCAPE_SSE2     1
+#define LGJ_ESCAPE_AVX2     2
+
+/*
+ * Same as lgj_escape(), but always uses p_nImpl (one of LGJ_ESCAPE_*)
+ * instead of the fastest one available, so they can be checked against each
+ * other.
+ *
+ * Returns NULL if this build or CPU can't use p_nImpl.
+ */
+char* lgj_escape_using(int p_nImpl, char* p_pDest, const char* p_sSrc, size_t p_nLen);
+
+/*
+ * Returns the most characters lgj_format_line() can write for p_pMsg.
+ */
+size_t lgj_line_max_len(const t_loggermsg* p_pMsg);
+
+/*
+ * Writes p_pMsg to p_pDest as a JSON object followed by a newline. p_pDest
+ * needs room for lgj_line_max_len() characters; nothing is null-terminated.
+ *
+ * Returns the end of what was written.
+ */
+char* lgj_format_line(char* p_pDest, const t_loggermsg* p_pMsg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
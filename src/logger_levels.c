@@ -71,7 +71,7 @@ int lgl_get_max_len(const char** lvl_strs) {
         return -1;
 
     int longest_len = -1;
-    for (int count = 0; count < LOGGER_MAX_LEVEL; count++) {
+    for (int count = 0; count <= LOGGER_MAX_LEVEL; count++) {
         int new_len = strlen(lvl_strs[count]);
         if (new_len > longest_len)
             longest_len = new_len;
@@ -11,15 +11,64 @@ extern "C" {
 
 #define LOGGER_MAX_FORMAT_SIZE 100
 
-#include <time.h>
+#include <stdint.h>
 
+/*
+ * What a producer writes to the buffer for each message, followed by
+ * m_nDataLen bytes of data in m_pData. Only the fields a producer knows are
+ * stored; the logger thread builds a t_loggermsg for each record it reads.
+ *
+ * m_pData normally holds the text of the message and its terminating '\0'.
+ * When m_sMsgFormat isn't NULL, it holds arguments encoded by lga_encode()
+ * instead, and the logger thread formats the message before it's written.
+ *
+ * When LOGGER_REC_HAS_SOURCE is set in m_nFlags, m_pData starts with a
+ * t_loggersrc, and the text or arguments come after it.
+ */
 typedef struct {
-    char        m_sMsg[CLOGGER_MAX_MESSAGE_SIZE];
+    const char* m_sMsgFormat;
+    uint64_t    m_nTimestamp;   // nanoseconds since the epoch (CLOCK_REALTIME)
+    uint32_t    m_nDataLen;
+    logger_id   m_nId;
+    unsigned int m_nHandlers;   // bit n is set to write to handler n
+    int         m_nThreadId;    // the kernel's ID for the thread that logged the message
+    int         m_nLine;
+    uint16_t    m_nLogLevel;
+    uint16_t    m_nFlags;
+    char        m_pData[];
+} t_loggerrec;
+
+#define LOGGER_REC_HAS_SOURCE 0x1
+
+/*
+ * Where a message was logged. It's only known for messages logged with the
+ * CLOG_* macros, which pass string literals, so they're stored as pointers.
+ */
+typedef struct {
+    const char* m_sFile;
+    const char* m_sFunc;
+} t_loggersrc;
+
+/*
+ * A message as handlers see it. The logger thread fills one in for each
+ * record it reads: m_sMsg points at the message's text, m_sId at the ID's
+ * text and m_sDate at the formatted date.
+ */
+typedef struct {
+    const char* m_sMsg;
+    int         m_nMsgLen;
     int         m_nLogLevel;
     logger_id   m_nId;
-    char*       m_sFormat;
-    char        m_sId[CLOGGER_ID_MAX_LEN];
-    struct tm   m_tmTime;
+    unsigned int m_nHandlers;   // bit n is set to write to handler n
+    const char* m_sDate;
+    int         m_nDateLen;
+    const char* m_sId;
+    int         m_nIdLen;
+    uint64_t    m_nTimestamp;   // nanoseconds since the epoch (CLOCK_REALTIME)
+    const char* m_sFile;        // NULL when where the message was logged isn't known
+    const char* m_sFunc;
+    int         m_nLine;
+    int         m_nThreadId;    // the kernel's ID for the thread that logged the message
 } t_loggermsg;
 
 #ifdef __cplusplus